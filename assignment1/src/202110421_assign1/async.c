@@ -0,0 +1,480 @@
+// 편예빈, Assignment 1, File name: async.c
+//
+// Asynchronous I/O pipeline for large inputs. There are ASYNC_DEPTH input blocks and ASYNC_DEPTH
+// output blocks. Reads are queued ahead of the DFA, which decomments the blocks in input order,
+// and every output block it fills is queued for writing while the DFA goes on in the next one.
+//
+// Two backends:
+//   io_uring  reads and writes are submitted to the kernel's queue (raw system calls, no liburing).
+//             Regular files are read and written at explicit offsets, so all blocks can be in flight
+//             at once; pipes, terminals and O_APPEND files have one read and one write in flight,
+//             which keeps them in order.
+//   threads   a reader thread (pread, or read for pipes) and a writer thread (pwrite, or write)
+//             pass blocks to and from the DFA through two pairs of queues. Used when io_uring is
+//             not available, or with -i threads.
+// Both produce exactly the output of the synchronous path, and leave the file offsets of infd and
+// outfd where the synchronous path would.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "dfa.h"
+#include "async.h"
+
+// one end of the pipeline: regular files are accessed at explicit offsets, anything else in order
+struct Target {
+  int fd;
+  int seekable;
+  off_t off;                      // next offset to read or write (if seekable)
+};
+
+static void openTarget(struct Target *t, int fd, int writing){
+  struct stat st;
+  t->fd = fd;
+  t->off = lseek(fd, 0, SEEK_CUR);
+  //O_APPEND makes pwrite(2) ignore the offset, so such files are written in order like pipes
+  t->seekable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && t->off >= 0 &&
+                !(writing && (fcntl(fd, F_GETFL) & O_APPEND));
+}
+
+//leaves the file offset where a synchronous read or write would have left it
+static void closeTarget(struct Target *t){
+  if (t->seekable) lseek(t->fd, t->off, SEEK_SET);
+}
+
+//--------------------------------------------------------------------------------------------------
+// io_uring backend
+
+#define TAG_READ  0x100           // user_data of a read: TAG_READ | block index
+#define TAG_WRITE 0x200           // user_data of a write: TAG_WRITE | block index
+
+// the submission and completion queues shared with the kernel
+struct Ring {
+  int fd;
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_size, cq_size, sqes_size;
+  unsigned queued;                // entries in the submission queue the kernel has not taken yet
+};
+
+struct Uring {
+  struct Ring ring;
+  struct Target src, dst;
+  size_t bufsize;
+  int reads, writes;              // operations in flight
+  // input blocks: fill bytes read so far of the block at input offset off
+  char *ibuf[ASYNC_DEPTH];
+  size_t ifill[ASYNC_DEPTH];
+  off_t ioff[ASYNC_DEPTH];
+  int ibusy[ASYNC_DEPTH], ires[ASYNC_DEPTH];
+  off_t next_in;                  // input offset of the next block to read
+  // output blocks: done of len bytes written to output offset off
+  char *obuf[ASYNC_DEPTH];
+  size_t olen[ASYNC_DEPTH], odone[ASYNC_DEPTH];
+  off_t ooff[ASYNC_DEPTH];
+  int obusy[ASYNC_DEPTH];
+  int cur;                        // output block the DFA writes into
+  struct OutBuf out;
+};
+
+static void ringFree(struct Ring *r){
+  if (r->sqes) munmap(r->sqes, r->sqes_size);
+  if (r->cq_ptr && r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_size);
+  if (r->sq_ptr) munmap(r->sq_ptr, r->sq_size);
+  if (r->fd >= 0) close(r->fd);
+}
+
+//sets up a ring with room for entries operations. Returns -1 if io_uring is not available
+static int ringInit(struct Ring *r, unsigned entries){
+  struct io_uring_params p;
+  memset(&p, 0, sizeof p);
+  memset(r, 0, sizeof *r);
+
+  r->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0) return -1;
+
+  r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) { //both rings are in one mapping
+    if (r->cq_size > r->sq_size) r->sq_size = r->cq_size;
+    r->cq_size = r->sq_size;
+  }
+  r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                   IORING_OFF_SQ_RING);
+  if (r->sq_ptr == MAP_FAILED) r->sq_ptr = NULL;
+  if (r->sq_ptr && (p.features & IORING_FEAT_SINGLE_MMAP)) r->cq_ptr = r->sq_ptr;
+  else if (r->sq_ptr) {
+    r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                     IORING_OFF_CQ_RING);
+    if (r->cq_ptr == MAP_FAILED) r->cq_ptr = NULL;
+  }
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  if (r->cq_ptr) {
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+                   IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) r->sqes = NULL;
+  }
+  if (r->sqes == NULL) {
+    ringFree(r);
+    return -1;
+  }
+
+  char *sq = r->sq_ptr, *cq = r->cq_ptr;
+  r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *)(sq + p.sq_off.array);
+  r->cq_head = (unsigned *)(cq + p.cq_off.head);
+  r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return 0;
+}
+
+//puts a read or write in the submission queue. off -1 reads or writes at the file position
+static void ringQueue(struct Ring *r, int op, int fd, char *buf, size_t len, off_t off, unsigned tag){
+  unsigned tail = *r->sq_tail; //only this thread moves the tail
+  unsigned i = tail & *r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[i];
+
+  memset(sqe, 0, sizeof *sqe);
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->off = (uint64_t)off;
+  sqe->user_data = tag;
+  r->sq_array[i] = i;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  r->queued++;
+}
+
+//hands the queued operations to the kernel and, if wait, waits for at least one to complete
+static void ringEnter(struct Ring *r, int wait){
+  while (r->queued > 0 || wait) {
+    int n = syscall(__NR_io_uring_enter, r->fd, r->queued, wait ? 1 : 0,
+                    wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("io_uring_enter");
+      exit(EXIT_FAILURE);
+    }
+    r->queued -= n;
+    return;
+  }
+}
+
+//takes the next completion (its tag and result), waiting for one if there is none yet
+static void ringWait(struct Ring *r, uint64_t *tag, int *res){
+  ringEnter(r, 0);
+  while (1) {
+    unsigned head = *r->cq_head;
+    if (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+      *tag = cqe->user_data;
+      *res = cqe->res;
+      __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+      return;
+    }
+    ringEnter(r, 1);
+  }
+}
+
+//queues the rest of input block i (all of it if nothing was read yet)
+static void queueRead(struct Uring *u, int i){
+  off_t off = u->src.seekable ? u->ioff[i] + (off_t)u->ifill[i] : -1;
+  ringQueue(&u->ring, IORING_OP_READ, u->src.fd, u->ibuf[i] + u->ifill[i], u->bufsize - u->ifill[i],
+            off, TAG_READ | i);
+  u->ibusy[i] = 1;
+  u->reads++;
+}
+
+//queues the next block of input into the free input block i
+static void readNext(struct Uring *u, int i){
+  u->ifill[i] = 0;
+  u->ioff[i] = u->next_in;
+  u->next_in += u->bufsize;
+  queueRead(u, i);
+}
+
+//queues the rest of output block i
+static void queueWrite(struct Uring *u, int i){
+  off_t off = u->dst.seekable ? u->ooff[i] + (off_t)u->odone[i] : -1;
+  ringQueue(&u->ring, IORING_OP_WRITE, u->dst.fd, u->obuf[i] + u->odone[i], u->olen[i] - u->odone[i],
+            off, TAG_WRITE | i);
+  u->obusy[i] = 1;
+  u->writes++;
+}
+
+//waits for one operation to complete and books it. Short writes are queued again
+static void complete(struct Uring *u){
+  uint64_t tag;
+  int res;
+  ringWait(&u->ring, &tag, &res);
+  int i = tag & 0xff;
+
+  if (tag & TAG_READ) {
+    u->reads--;
+    u->ibusy[i] = 0;
+    u->ires[i] = res;
+    return;
+  }
+  u->writes--;
+  if (res == -EINTR || res == -EAGAIN) res = 0;
+  else if (res < 0) {
+    errno = -res;
+    perror("write");
+    exit(EXIT_FAILURE);
+  }
+  u->odone[i] += res;
+  if (u->odone[i] < u->olen[i]) queueWrite(u, i);
+  else u->obusy[i] = 0;
+}
+
+//OutBuf callback: the full output block goes to the kernel and the DFA gets the next free one
+static void uringFlush(void *arg, const char *data, size_t len){
+  struct Uring *u = arg;
+  int i = u->cur;
+  (void)data; //always obuf[cur]
+
+  if (!u->dst.seekable) //in order: the block before this one has to be out first
+    while (u->writes > 0) complete(u);
+  u->olen[i] = len;
+  u->odone[i] = 0;
+  u->ooff[i] = u->dst.off;
+  u->dst.off += len;
+  queueWrite(u, i);
+  ringEnter(&u->ring, 0);
+
+  u->cur = (i + 1) % ASYNC_DEPTH;
+  while (u->obusy[u->cur]) complete(u);
+  u->out.buf = u->obuf[u->cur];
+}
+
+//runs the pipeline on io_uring. Returns -1 (before any I/O) if io_uring is not available
+static int runUring(int infd, int outfd, size_t bufsize, char *bufs, struct DFA *dfa){
+  struct Uring *u = calloc(1, sizeof *u);
+  if (u == NULL || ringInit(&u->ring, 4 * ASYNC_DEPTH) < 0) {
+    free(u);
+    return -1;
+  }
+  openTarget(&u->src, infd, 0);
+  openTarget(&u->dst, outfd, 1);
+  u->bufsize = bufsize;
+  u->next_in = u->src.off;
+  for (int i = 0; i < ASYNC_DEPTH; i++) {
+    u->ibuf[i] = bufs + i * bufsize;
+    u->obuf[i] = bufs + (ASYNC_DEPTH + i) * bufsize;
+  }
+  struct OutBuf out = { OUT_CALLBACK, u->obuf[0], 0, bufsize, NULL, 0, 0, uringFlush, u, NULL };
+  u->out = out;
+
+  //regular files: every block is read ahead; anything else: the next block only
+  for (int i = 0; i < (u->src.seekable ? ASYNC_DEPTH : 1); i++) readNext(u, i);
+
+  off_t consumed = u->src.off;
+  int i = 0;
+  while (1) {
+    while (u->ibusy[i]) complete(u);
+    int res = u->ires[i];
+    if (res == -EINTR || res == -EAGAIN) { //try again
+      queueRead(u, i);
+      continue;
+    }
+    if (res < 0) {
+      errno = -res;
+      perror("read");
+      exit(EXIT_FAILURE);
+    }
+    u->ifill[i] += res;
+    if (u->src.seekable && res > 0 && u->ifill[i] < bufsize) { //short read inside the file
+      queueRead(u, i);
+      continue;
+    }
+    if (u->ifill[i] == 0) break; //EOF
+    int last = (res == 0); //EOF inside this block
+
+    if (!u->src.seekable) readNext(u, (i + 1) % ASYNC_DEPTH);
+    ringEnter(&u->ring, 0);
+    decomment(dfa, u->ibuf[i], u->ifill[i], &u->out);
+    consumed += u->ifill[i];
+    if (last) break;
+    if (u->src.seekable) readNext(u, i);
+    i = (i + 1) % ASYNC_DEPTH;
+  }
+  outFlush(&u->out);
+  while (u->reads > 0 || u->writes > 0) complete(u); //reads past EOF and the last writes
+
+  u->src.off = consumed;
+  closeTarget(&u->src);
+  closeTarget(&u->dst);
+  ringFree(&u->ring);
+  free(u);
+  return 0;
+}
+
+//--------------------------------------------------------------------------------------------------
+// pread/pwrite thread pair
+
+// a block passed between the threads; len 0 ends the stream
+struct Block {
+  char *buf;
+  size_t len;
+};
+
+// blocking FIFO of blocks
+struct Queue {
+  struct Block b[ASYNC_DEPTH + 1];
+  int head, count;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+struct Threads {
+  struct Target src, dst;
+  size_t bufsize;
+  struct Queue in_free, in_full, out_free, out_full;
+  struct OutBuf out;
+};
+
+static void queueInit(struct Queue *q){
+  q->head = q->count = 0;
+  pthread_mutex_init(&q->lock, NULL);
+  pthread_cond_init(&q->cond, NULL);
+}
+
+static void queuePut(struct Queue *q, char *buf, size_t len){
+  pthread_mutex_lock(&q->lock);
+  struct Block *b = &q->b[(q->head + q->count++) % (ASYNC_DEPTH + 1)];
+  b->buf = buf;
+  b->len = len;
+  pthread_cond_signal(&q->cond);
+  pthread_mutex_unlock(&q->lock);
+}
+
+static struct Block queueGet(struct Queue *q){
+  pthread_mutex_lock(&q->lock);
+  while (q->count == 0) pthread_cond_wait(&q->cond, &q->lock);
+  struct Block b = q->b[q->head];
+  q->head = (q->head + 1) % (ASYNC_DEPTH + 1);
+  q->count--;
+  pthread_mutex_unlock(&q->lock);
+  return b;
+}
+
+//reader thread: fills free input blocks until EOF
+static void *readerThread(void *arg){
+  struct Threads *t = arg;
+  while (1) {
+    struct Block b = queueGet(&t->in_free);
+    ssize_t n;
+    do n = t->src.seekable ? pread(t->src.fd, b.buf, t->bufsize, t->src.off)
+                           : read(t->src.fd, b.buf, t->bufsize);
+    while (n < 0 && errno == EINTR);
+    if (n < 0) {
+      perror("read");
+      exit(EXIT_FAILURE);
+    }
+    t->src.off += n;
+    queuePut(&t->in_full, b.buf, n);
+    if (n == 0) return NULL; //EOF
+  }
+}
+
+//writer thread: writes full output blocks in order until the empty one
+static void *writerThread(void *arg){
+  struct Threads *t = arg;
+  while (1) {
+    struct Block b = queueGet(&t->out_full);
+    if (b.len == 0) return NULL;
+    if (!t->dst.seekable) writeAll(t->dst.fd, b.buf, b.len);
+    else {
+      for (size_t done = 0; done < b.len; ) {
+        ssize_t w = pwrite(t->dst.fd, b.buf + done, b.len - done, t->dst.off);
+        if (w < 0) {
+          if (errno == EINTR) continue;
+          perror("write");
+          exit(EXIT_FAILURE);
+        }
+        done += w;
+        t->dst.off += w;
+      }
+    }
+    queuePut(&t->out_free, b.buf, 0);
+  }
+}
+
+//OutBuf callback: the full output block goes to the writer and the DFA gets a free one
+static void threadsFlush(void *arg, const char *data, size_t len){
+  struct Threads *t = arg;
+  queuePut(&t->out_full, (char *)data, len);
+  t->out.buf = queueGet(&t->out_free).buf;
+}
+
+static void runThreads(int infd, int outfd, size_t bufsize, char *bufs, struct DFA *dfa){
+  struct Threads *t = calloc(1, sizeof *t);
+  pthread_t reader, writer;
+
+  if (t == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  openTarget(&t->src, infd, 0);
+  openTarget(&t->dst, outfd, 1);
+  t->bufsize = bufsize;
+  queueInit(&t->in_free);
+  queueInit(&t->in_full);
+  queueInit(&t->out_free);
+  queueInit(&t->out_full);
+  for (int i = 0; i < ASYNC_DEPTH; i++) queuePut(&t->in_free, bufs + i * bufsize, 0);
+  for (int i = 1; i < ASYNC_DEPTH; i++) queuePut(&t->out_free, bufs + (ASYNC_DEPTH + i) * bufsize, 0);
+  struct OutBuf out = { OUT_CALLBACK, bufs + ASYNC_DEPTH * bufsize, 0, bufsize, NULL, 0, 0,
+                        threadsFlush, t, NULL };
+  t->out = out;
+
+  if (pthread_create(&reader, NULL, readerThread, t) != 0 ||
+      pthread_create(&writer, NULL, writerThread, t) != 0) {
+    perror("pthread_create");
+    exit(EXIT_FAILURE);
+  }
+  while (1) {
+    struct Block b = queueGet(&t->in_full);
+    if (b.len == 0) break;
+    decomment(dfa, b.buf, b.len, &t->out);
+    queuePut(&t->in_free, b.buf, 0);
+  }
+  outFlush(&t->out);
+  queuePut(&t->out_full, NULL, 0);
+  pthread_join(reader, NULL);
+  pthread_join(writer, NULL);
+
+  closeTarget(&t->src);
+  closeTarget(&t->dst);
+  free(t);
+}
+
+//decomments infd to outfd through the pipeline: on io_uring if uring is set and the kernel has
+//it, on the thread pair otherwise
+void decommentAsync(int infd, int outfd, size_t bufsize, int uring, struct DFA *dfa)
+{
+  char *bufs = malloc(2 * ASYNC_DEPTH * bufsize);
+  if (bufs == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  if (!uring || runUring(infd, outfd, bufsize, bufs, dfa) < 0)
+    runThreads(infd, outfd, bufsize, bufs, dfa);
+  free(bufs);
+}
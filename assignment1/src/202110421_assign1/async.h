@@ -0,0 +1,17 @@
+// 편예빈, Assignment 1, File name: async.h
+//
+// Asynchronous I/O pipeline (-i uring, -i threads): several input blocks are read ahead of the
+// DFA and several output blocks drain behind it, so reading, decommenting and writing overlap.
+
+#ifndef _ASYNC_H_
+#define _ASYNC_H_
+
+#include <stddef.h>
+
+#include "dfa.h"
+
+#define ASYNC_DEPTH 4 // input blocks in flight ahead of the DFA, output blocks behind it
+
+void decommentAsync(int infd, int outfd, size_t bufsize, int uring, struct DFA *dfa);
+
+#endif
@@ -0,0 +1,229 @@
+// 편예빈, Assignment 1, File name: cache.c
+//
+// Output cache. Every entry is one file, dir/<hash>.dc: struct CacheHeader, then the output, then
+// the diagnostics text. The hash is MurmurHash3 (x64, 128 bits) of the input, seeded with
+// CACHE_VERSION so that entries written by a decomment that prints something else are never used.
+//
+// Entries are written to a temporary file and renamed into place, so concurrent runs sharing the
+// directory only ever see whole entries. A hit sets the entry's modification time to now; when a
+// miss makes the directory larger than its cap, the least recently used entries are removed until
+// it is 10% below the cap. The directory is only scanned on a miss, hits cost the hash and a copy.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dfa.h"
+#include "cache.h"
+
+#define CACHE_MAGIC 0x48434443    // "CDCH"
+#define CACHE_VERSION 1           // change when the output for the same input changes
+#define MAX_PATH_LEN 4096
+
+struct CacheHeader {
+  uint32_t magic;
+  uint32_t errlen;
+  uint64_t outlen;
+  uint64_t hash[2];               // checked on a hit, in case of a truncated or foreign file
+};
+
+// a cache file found while evicting
+struct Entry {
+  char name[40];
+  struct timespec used;            // modification time: set when the entry was last hit
+  off_t size;
+};
+
+//--------------------------------------------------------------------------------------------------
+// MurmurHash3_x64_128 (Austin Appleby, public domain)
+
+static inline uint64_t rotl64(uint64_t x, int r){
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k){
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+static void murmur3(const char *data, size_t len, uint64_t seed, uint64_t out[2]){
+  const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+  const unsigned char *p = (const unsigned char *)data;
+  size_t nblocks = len / 16;
+  uint64_t h1 = seed, h2 = seed, k1, k2;
+
+  for (size_t i = 0; i < nblocks; i++, p += 16) {
+    memcpy(&k1, p, 8);
+    memcpy(&k2, p + 8, 8);
+    k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+    k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+  }
+
+  k1 = k2 = 0;
+  switch (len & 15) { //the last 0-15 bytes
+    case 15: k2 ^= (uint64_t)p[14] << 48; /* fall through */
+    case 14: k2 ^= (uint64_t)p[13] << 40; /* fall through */
+    case 13: k2 ^= (uint64_t)p[12] << 32; /* fall through */
+    case 12: k2 ^= (uint64_t)p[11] << 24; /* fall through */
+    case 11: k2 ^= (uint64_t)p[10] << 16; /* fall through */
+    case 10: k2 ^= (uint64_t)p[9] << 8;   /* fall through */
+    case 9:  k2 ^= (uint64_t)p[8];
+             k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+             /* fall through */
+    case 8:  k1 ^= (uint64_t)p[7] << 56;  /* fall through */
+    case 7:  k1 ^= (uint64_t)p[6] << 48;  /* fall through */
+    case 6:  k1 ^= (uint64_t)p[5] << 40;  /* fall through */
+    case 5:  k1 ^= (uint64_t)p[4] << 32;  /* fall through */
+    case 4:  k1 ^= (uint64_t)p[3] << 24;  /* fall through */
+    case 3:  k1 ^= (uint64_t)p[2] << 16;  /* fall through */
+    case 2:  k1 ^= (uint64_t)p[1] << 8;   /* fall through */
+    case 1:  k1 ^= (uint64_t)p[0];
+             k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+  }
+
+  h1 ^= len; h2 ^= len;
+  h1 += h2; h2 += h1;
+  h1 = fmix64(h1); h2 = fmix64(h2);
+  h1 += h2; h2 += h1;
+  out[0] = h1;
+  out[1] = h2;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Entries
+
+//writes a hit to stdout and stderr. Returns -1 if there is no usable entry at path
+static int cacheHit(const char *path, const uint64_t hash[2], int quiet){
+  struct CacheHeader h;
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+
+  if (read(fd, &h, sizeof h) != sizeof h || h.magic != CACHE_MAGIC || h.hash[0] != hash[0] ||
+      h.hash[1] != hash[1] || fstat(fd, &st) < 0 ||
+      (uint64_t)st.st_size != sizeof h + h.outlen + h.errlen) {
+    close(fd);
+    return -1;
+  }
+  char *p = NULL;
+  if (st.st_size > (off_t)sizeof h) {
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      return -1;
+    }
+  }
+  futimens(fd, NULL); //most recently used
+  close(fd);
+  if (p == NULL) return 0; //no output and no diagnostics: nothing was mapped
+
+  writeAll(STDOUT_FILENO, p + sizeof h, h.outlen);
+  if (!quiet) writeAll(STDERR_FILENO, p + sizeof h + h.outlen, h.errlen);
+  munmap(p, st.st_size);
+  return 0;
+}
+
+static int byUse(const void *a, const void *b){
+  const struct Entry *x = a, *y = b;
+  if (x->used.tv_sec != y->used.tv_sec) return (x->used.tv_sec > y->used.tv_sec) ? 1 : -1;
+  return (x->used.tv_nsec > y->used.tv_nsec) - (x->used.tv_nsec < y->used.tv_nsec);
+}
+
+//removes the least recently used entries if dir is over cap
+static void cacheEvict(const char *dir, size_t cap){
+  DIR *d = opendir(dir);
+  struct dirent *de;
+  struct Entry *e = NULL;
+  size_t count = 0, size = 0, total = 0;
+  char path[MAX_PATH_LEN];
+
+  if (d == NULL) return;
+  while ((de = readdir(d)) != NULL) {
+    size_t len = strlen(de->d_name);
+    struct stat st;
+    if (len < 4 || len >= sizeof e->name || strcmp(de->d_name + len - 3, ".dc")) continue;
+    snprintf(path, sizeof path, "%s/%s", dir, de->d_name);
+    if (stat(path, &st) < 0) continue;
+    if (count == size) {
+      size = size ? size * 2 : 256;
+      struct Entry *tmp = realloc(e, size * sizeof *e);
+      if (tmp == NULL) break;
+      e = tmp;
+    }
+    strcpy(e[count].name, de->d_name);
+    e[count].used = st.st_mtim;
+    e[count].size = st.st_size;
+    total += st.st_size;
+    count++;
+  }
+  closedir(d);
+
+  if (total > cap) {
+    qsort(e, count, sizeof *e, byUse);
+    for (size_t i = 0; i < count && total > cap - cap / 10; i++) {
+      snprintf(path, sizeof path, "%s/%s", dir, e[i].name);
+      if (unlink(path) == 0) total -= e[i].size;
+    }
+  }
+  free(e);
+}
+
+//stores an entry. The cache is only an optimization: if it cannot be written, nothing is stored
+static void cacheStore(const char *dir, const char *path, const uint64_t hash[2],
+                       const char *out, size_t outlen, const char *err, size_t errlen){
+  struct CacheHeader h = { CACHE_MAGIC, (uint32_t)errlen, outlen, { hash[0], hash[1] } };
+  char tmp[MAX_PATH_LEN];
+
+  mkdir(dir, 0755);
+  snprintf(tmp, sizeof tmp, "%s/.tmp.%d.%016llx", dir, (int)getpid(), (unsigned long long)hash[0]);
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return;
+
+  struct iovec iov[3] = { { &h, sizeof h }, { (void *)out, outlen }, { (void *)err, errlen } };
+  writevAll(fd, iov, 3);
+  if (close(fd) < 0 || rename(tmp, path) < 0) unlink(tmp);
+}
+
+//decomments in[0, n) to stdout (and the diagnostics to stderr unless quiet), from the cache in dir
+//if it has the input, and into it if not
+void decommentCached(const char *dir, size_t cap, const char *in, size_t n, int quiet)
+{
+  uint64_t hash[2];
+  char path[MAX_PATH_LEN];
+
+  murmur3(in, n, CACHE_VERSION, hash);
+  snprintf(path, sizeof path, "%s/%016llx%016llx.dc", dir, (unsigned long long)hash[0],
+           (unsigned long long)hash[1]);
+  if (cacheHit(path, hash, quiet) == 0) return;
+
+  //miss: the output is kept in memory, then written out and stored
+  struct DFA dfa = DFA_INIT;
+  struct OutBuf out = { OUT_MEMORY, malloc(n + 64), 0, n + 64, NULL, 0, 0, NULL, NULL, NULL };
+  char err[64] = "";
+  if (out.buf == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  decomment(&dfa, in, n, &out);
+  if (dfa.state == MULTILINE || dfa.state == WAIT_END)
+    snprintf(err, sizeof err, "Error: line %d: unterminated comment\n", dfa.line_com);
+
+  writeAll(STDOUT_FILENO, out.buf, out.len);
+  if (!quiet) writeAll(STDERR_FILENO, err, strlen(err));
+  cacheStore(dir, path, hash, out.buf, out.len, err, strlen(err));
+  cacheEvict(dir, cap);
+  free(out.buf);
+}
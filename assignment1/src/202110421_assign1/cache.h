@@ -0,0 +1,15 @@
+// 편예빈, Assignment 1, File name: cache.h
+//
+// Content-addressed output cache (--cache dir): the output and diagnostics of an input are kept
+// under a 128-bit hash of it, so decommenting the same input again is a hash and a copy.
+
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stddef.h>
+
+#define DEFAULT_CACHE_SIZE (256 << 20) // default size cap of the cache directory (256 MiB)
+
+void decommentCached(const char *dir, size_t cap, const char *in, size_t n, int quiet);
+
+#endif
@@ -0,0 +1,273 @@
+// 편예빈, Assignment 1, File name: checkpoint.c
+//
+// Checkpoint index (--checkpoint file): struct IndexHeader followed by IndexHeader.count
+// struct Checkpoint, in input order. The first one is at input offset 0, the last one at the end
+// of the input (it holds the final DFA); in between they are about every N bytes apart. Each holds
+// the whole DFA at that input offset and how many bytes of output were written before it, which
+// is all that is needed to carry on from there: the DFA never holds back output it owes (a '/'
+// that may start a comment is in WAIT_COMMENT, not in a buffer).
+//
+// After an edit, the run restarts from the last checkpoint before the edit. Every old checkpoint
+// behind the edit is still at the same distance from the end of the input; once the new run gets
+// to one of them in the same state (line numbers may have moved by the number of lines the edit
+// added or removed), everything from there on is the same as before, and the previous output is
+// copied from that checkpoint's output offset.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dfa.h"
+#include "checkpoint.h"
+
+#define INDEX_MAGIC 0x58444943    // "CIDX"
+
+struct IndexHeader {
+  uint32_t magic;
+  uint32_t count;                 // number of checkpoints
+  uint64_t every;                 // distance between checkpoints when the index was written
+};
+
+// the DFA at one input offset, in fixed-size fields
+struct Checkpoint {
+  uint64_t in_off, out_off;
+  int32_t state, line_cur, line_com;
+  int8_t cquote_type, ibackslash;
+  int16_t pad;
+};
+
+// growing list of checkpoints
+struct Index {
+  struct Checkpoint *cp;
+  size_t count, cap;
+};
+
+// output of a checkpointed run: goes to fd, and is counted for the output offsets
+struct Sink {
+  int fd;
+  uint64_t written;
+};
+
+//decomment_out_fn writing to a Sink
+static void sinkWrite(void *arg, const char *data, size_t len){
+  struct Sink *s = arg;
+  writeAll(s->fd, data, len);
+  s->written += len;
+}
+
+static void addCheckpoint(struct Index *ix, uint64_t in_off, uint64_t out_off, const struct DFA *dfa){
+  if (ix->count == ix->cap) {
+    ix->cap = ix->cap ? ix->cap * 2 : 64;
+    ix->cp = realloc(ix->cp, ix->cap * sizeof *ix->cp);
+    if (ix->cp == NULL) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  struct Checkpoint *c = &ix->cp[ix->count++];
+  memset(c, 0, sizeof *c);
+  c->in_off = in_off;
+  c->out_off = out_off;
+  c->state = dfa->state;
+  c->line_cur = dfa->line_cur;
+  c->line_com = dfa->line_com;
+  c->cquote_type = dfa->cquote_type;
+  c->ibackslash = dfa->ibackslash;
+}
+
+static struct DFA checkpointDFA(const struct Checkpoint *c){
+  struct DFA dfa = { (enum DFAState)c->state, c->line_cur, c->line_com, c->cquote_type, c->ibackslash,
+                     (long long)c->in_off };
+  return dfa;
+}
+
+//returns 1 if dfa, lines moved by dl, is the DFA saved in c
+static int inStep(const struct DFA *dfa, const struct Checkpoint *c, int dl){
+  if ((int)dfa->state != c->state || dfa->cquote_type != c->cquote_type ||
+      dfa->ibackslash != c->ibackslash || dfa->line_cur != c->line_cur + dl)
+    return 0;
+  //the line of an open comment is printed if it is never closed
+  return (dfa->state != MULTILINE && dfa->state != WAIT_END) || dfa->line_com == c->line_com + dl;
+}
+
+//writes the index to a temporary file and renames it over path, so readers never see half of it
+static void writeIndex(const char *path, const struct Index *ix, size_t every){
+  struct IndexHeader h = { INDEX_MAGIC, (uint32_t)ix->count, every };
+  char tmp[4096];
+
+  snprintf(tmp, sizeof tmp, "%s.tmp", path);
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(tmp);
+    exit(EXIT_FAILURE);
+  }
+  writeAll(fd, (const char *)&h, sizeof h);
+  writeAll(fd, (const char *)ix->cp, ix->count * sizeof *ix->cp);
+  if (close(fd) < 0 || rename(tmp, path) < 0) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+}
+
+//reads the index at path. Returns -1 if there is none or it is not a valid index
+static int readIndex(const char *path, struct Index *ix){
+  struct IndexHeader h;
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+
+  ssize_t r = read(fd, &h, sizeof h);
+  if (r != sizeof h || h.magic != INDEX_MAGIC || h.count < 2) {
+    close(fd);
+    return -1;
+  }
+  ix->cap = ix->count = h.count;
+  ix->cp = malloc(ix->cap * sizeof *ix->cp);
+  size_t want = ix->count * sizeof *ix->cp, got = 0;
+  while (ix->cp && got < want && (r = read(fd, (char *)ix->cp + got, want - got)) > 0) got += r;
+  close(fd);
+  if (ix->cp == NULL || got < want || ix->cp[0].in_off != 0) {
+    free(ix->cp);
+    return -1;
+  }
+  return 0;
+}
+
+//runs the DFA over in[from, to) from ctx, adding a checkpoint every `every` bytes and at to
+static void runCheckpointed(struct decomment_ctx *ctx, struct Sink *sink, struct Index *ix,
+                            const char *in, size_t from, size_t to, size_t every){
+  while (from < to) {
+    size_t n = to - from < every ? to - from : every;
+    decomment_feed(ctx, in + from, n, sinkWrite, sink);
+    from += n;
+    addCheckpoint(ix, from, sink->written, &ctx->dfa);
+  }
+}
+
+//decomments in[0, n) to outfd and writes a checkpoint index for it to path
+void decommentCheckpointed(const char *in, size_t n, int outfd, const char *index, size_t every,
+                           struct DFA *dfa)
+{
+  struct decomment_ctx ctx;
+  struct Sink sink = { outfd, 0 };
+  struct Index ix = { NULL, 0, 0 };
+
+  if (decomment_ctx_init(&ctx, DEFAULT_BUFSIZE) < 0) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  addCheckpoint(&ix, 0, 0, &ctx.dfa);
+  runCheckpointed(&ctx, &sink, &ix, in, 0, n, every);
+  if (n == 0) addCheckpoint(&ix, 0, 0, &ctx.dfa); //the end of the input gets one too
+
+  decomment_finish(&ctx, sinkWrite, &sink);
+  *dfa = ctx.dfa;
+  decomment_ctx_free(&ctx);
+  writeIndex(index, &ix, every);
+  free(ix.cp);
+}
+
+//decomments in[0, n), which is the input of the run that wrote the index and its output previous
+//with edit applied, reusing as much of that run as possible. Output goes to outfd and the index is
+//updated. If the index or previous output cannot be used, the whole input is decommented again.
+//Returns the number of input bytes that went through the DFA
+size_t decommentEdited(const char *in, size_t n, int outfd, const char *index, const char *previous,
+                       const struct Edit *edit, size_t every, struct DFA *dfa)
+{
+  struct Index old = { NULL, 0, 0 }, ix = { NULL, 0, 0 };
+  struct stat st;
+  char *prev = NULL;
+  size_t r, j;
+
+  if (readIndex(index, &old) < 0) goto full;
+  uint64_t old_n = old.cp[old.count - 1].in_off, prev_n = old.cp[old.count - 1].out_off;
+  //the old input is n - delta bytes long, and bytes [start, old_end) of it were replaced
+  long long delta = (long long)n - (long long)old_n;
+  long long old_end = (long long)edit->end - delta;
+  if (edit->start > edit->end || edit->end > n || old_end < (long long)edit->start ||
+      old_end > (long long)old_n)
+    goto full;
+
+  int pfd = open(previous, O_RDONLY);
+  if (pfd < 0) goto full;
+  if (fstat(pfd, &st) < 0 || (uint64_t)st.st_size != prev_n) {
+    close(pfd);
+    goto full;
+  }
+  if (prev_n > 0) {
+    prev = mmap(NULL, prev_n, PROT_READ, MAP_PRIVATE, pfd, 0);
+    if (prev == MAP_FAILED) {
+      close(pfd);
+      goto full;
+    }
+  }
+  close(pfd);
+
+  //everything up to the last checkpoint at or before the edit is unchanged
+  for (r = 0; r + 1 < old.count && old.cp[r + 1].in_off <= edit->start; r++);
+  ix.count = ix.cap = r + 1;
+  ix.cp = malloc(ix.cap * sizeof *ix.cp);
+  if (ix.cp == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(ix.cp, old.cp, ix.count * sizeof *ix.cp);
+  writeAll(outfd, prev, old.cp[r].out_off);
+
+  struct decomment_ctx ctx;
+  struct Sink sink = { outfd, old.cp[r].out_off };
+  if (decomment_ctx_init(&ctx, DEFAULT_BUFSIZE) < 0) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  ctx.dfa = checkpointDFA(&old.cp[r]);
+  size_t pos = old.cp[r].in_off, redone = 0;
+
+  //first old checkpoint behind the edit, and its offset in the new input
+  for (j = r + 1; j < old.count && (long long)old.cp[j].in_off < old_end; j++);
+  while (1) {
+    size_t stop = n;
+    if (j < old.count) stop = old.cp[j].in_off + delta;
+    runCheckpointed(&ctx, &sink, &ix, in, pos, stop, every);
+    redone += stop - pos;
+    pos = stop;
+    if (j == old.count) break; //ran to the end without getting back in step
+
+    int dl = ctx.dfa.line_cur - old.cp[j].line_cur;
+    if (inStep(&ctx.dfa, &old.cp[j], dl)) {
+      //the rest of the output and of the checkpoints is the old one, moved
+      writeAll(outfd, prev + old.cp[j].out_off, prev_n - old.cp[j].out_off);
+      int64_t dout = (int64_t)sink.written - (int64_t)old.cp[j].out_off;
+      if (ix.count > 0 && ix.cp[ix.count - 1].in_off == pos) ix.count--; //same offset, same DFA
+      for (; j < old.count; j++) {
+        struct DFA d = checkpointDFA(&old.cp[j]);
+        d.line_cur += dl;
+        if (d.line_com >= 0) d.line_com += dl;
+        addCheckpoint(&ix, old.cp[j].in_off + delta, old.cp[j].out_off + dout, &d);
+      }
+      ctx.dfa = checkpointDFA(&ix.cp[ix.count - 1]);
+      break;
+    }
+    j++;
+  }
+  if (ix.cp[ix.count - 1].in_off != n || ix.count < 2) //the end of the input gets one too
+    addCheckpoint(&ix, n, sink.written, &ctx.dfa);
+
+  decomment_ctx_free(&ctx);
+  *dfa = ctx.dfa;
+  writeIndex(index, &ix, every);
+  free(ix.cp);
+  free(old.cp);
+  if (prev) munmap(prev, prev_n);
+  return redone;
+
+full:
+  free(old.cp);
+  decommentCheckpointed(in, n, outfd, index, every, dfa);
+  return n;
+}
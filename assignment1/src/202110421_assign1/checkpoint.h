@@ -0,0 +1,27 @@
+// 편예빈, Assignment 1, File name: checkpoint.h
+//
+// Checkpointed runs: decomment can write a sidecar index holding the DFA and the output offset
+// every N input bytes, and use it after an edit to decomment only from the checkpoint before the
+// edit up to where the DFA is back in step with the previous run, copying the rest of the output
+// from that run.
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <stddef.h>
+
+#include "dfa.h"
+
+#define DEFAULT_CHECKPOINT_EVERY (1 << 16) // default distance between two checkpoints (64 KiB)
+
+// an edit: bytes [start, end) of the new input replace some bytes starting at start in the old one
+struct Edit {
+  size_t start, end;
+};
+
+void decommentCheckpointed(const char *in, size_t n, int outfd, const char *index, size_t every,
+                           struct DFA *dfa);
+size_t decommentEdited(const char *in, size_t n, int outfd, const char *index, const char *previous,
+                       const struct Edit *edit, size_t every, struct DFA *dfa);
+
+#endif
@@ -4,130 +4,858 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
 
-enum DFAState {START, QUOTE, CHAR, WAIT_COMMENT, SINGLELINE, MULTILINE, WAIT_END};
-static void handleQuote(enum DFAState *state, int ich, char cquote_type, int *backslash);
-static void handleWaitComment(enum DFAState *state, int ich, int line_cur, int *line_com);
-static void handleWaitEnd(enum DFAState *state, int ich);
+#include "dfa.h"
+#include "server.h"
+#include "checkpoint.h"
+#include "async.h"
+#include "cache.h"
+#include "stats.h"
+#include "passthrough.h"
+#include "tree.h"
 
-int main(void)
+#define MIN_BUFSIZE 16            // smallest block size accepted by -b
+#define MAX_THREADS 256           // largest thread count accepted by -j
+#define SPEC_STEP (1 << 16)       // speculative runs are compared after every SPEC_STEP bytes
+#define MAX_PATH_LEN 4096         // longest output path built by --batch
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+enum InputMode {IN_AUTO, IN_MMAP, IN_STREAM, IN_URING, IN_THREADS, IN_SPLICE}; // how the input is read (-i)
+
+static void decommentStream(int fd, int outfd, size_t bufsize, struct DFA *dfa, struct OutBuf *com);
+static void decommentMapped(const char *in, size_t n, int outfd, struct DFA *dfa, struct OutBuf *com);
+static void decommentParallel(const char *in, size_t n, int nthreads, struct DFA *dfa);
+static char *mapInput(int fd, size_t *len, int required);
+static char *readAll(int fd, size_t *len);
+static int decommentBatch(const char **paths, int npaths, const char *outdir, int nthreads,
+                          size_t bufsize, enum InputMode input);
+static const char **readFileList(const char *list, const char **paths, int *npaths, int *cap);
+static size_t parseSize(const char *s);
+static void usage(const char *argv0);
+
+int main(int argc, char *argv[])
 {
-  // ich: int type variable to store character input from getchar()
-  int ich;
-  // line_cur & line_com: current line number and comment line number
-  int line_cur, line_com;
-  // ch: character that comes from casting (char) on ich
-  char ch; 
-  //char that specifies if the prev input was a single ' or double quote "
-  char cquote_type;
-  // int that specifies if prev input was a backslash \ or not
-  int ibackslash = 0;
-  
-  line_cur = 1;
-  line_com = -1;
-  enum DFAState state = START;
-
-  while (1) { //reads all characters from standard input one by one
-    ich = getchar();
-    ch = (char)ich;
-
-    if(ich == EOF) {
-      if(state == MULTILINE || state == WAIT_END) //if it's EOF without closing comment, break and output error
-        fprintf(stderr, "Error: line %d: unterminated comment\n", line_com);
-      break;
-    }
-
-    switch(state) {
-      case START: //if state is START
-        if(ich == '/') //if input is '/', wait to see if it is a comment
-          state = WAIT_COMMENT;
-        else if(ich == '\"' || ich == '\''){ //if input is a quote, change to QUOTE state
-          cquote_type = ich; //indicate which quote was used (single or double)
-          putchar(ich);
-          state = QUOTE;
+  // bufsize: size of the block read from stdin (and of the output block)
+  size_t bufsize = DEFAULT_BUFSIZE;
+  // isa: scanner forced with -s, NULL picks the best one the CPU supports
+  const char *isa = NULL;
+  // nthreads: number of chunks decommented in parallel (-j), 1 is the serial streaming mode
+  int nthreads = 1;
+  // input: how the input is read, infd: the input file (stdin unless a path is given)
+  enum InputMode input = IN_AUTO;
+  int infd = STDIN_FILENO;
+  // batch: --batch mode, outdir: where it writes, paths: the input files given on the command line
+  int batch = 0;
+  const char *outdir = NULL;
+  const char **paths = NULL;
+  int npaths = 0, cap = 0;
+  // serve: socket of --serve, client: socket of --client (or $DECOMMENT_SOCKET)
+  const char *serve = NULL, *client = NULL;
+  // index: checkpoint index (--checkpoint), previous: output of the run that wrote it, edit: --edit
+  const char *index = NULL, *previous = NULL;
+  size_t every = DEFAULT_CHECKPOINT_EVERY;
+  struct Edit edit = { 0, 0 };
+  int edited = 0;
+  // comments: file the comments go to (--comments), com: its output block
+  const char *comments = NULL;
+  struct OutBuf com = { -1, NULL, 0, 0, NULL, 0, 0, NULL, NULL, NULL };
+  // quiet: -q, unterminated comments are not reported, so line numbers need not be kept
+  int quiet = 0;
+  // cache: output cache directory (--cache), cache_size: its size cap
+  const char *cache = NULL;
+  size_t cache_size = DEFAULT_CACHE_SIZE;
+  // stats: --stats, the profiling counters are printed on stderr at the end
+  int stats = 0;
+  // tree_src, tree_dst: -r, log: where tree mode writes its log (--log)
+  const char *tree_src = NULL, *tree_dst = NULL, *log = NULL;
+  struct DFA dfa = DFA_INIT;
+
+  STAT_PHASE(PH_SETUP);
+
+  for (int i = 1; i < argc; i++) { //parse options
+    if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+      bufsize = parseSize(argv[++i]);
+      if (bufsize < MIN_BUFSIZE) {
+        fprintf(stderr, "Invalid buffer size '%s'.\n", argv[i]);
+        usage(argv[0]);
+      }
+    }
+    else if (!strcmp(argv[i], "-s") && i + 1 < argc) isa = argv[++i];
+    else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+      i++;
+      if (!strcmp(argv[i], "switch")) decomment = decommentBlock;
+      else if (!strcmp(argv[i], "table")) decomment = decommentTable;
+      else {
+        fprintf(stderr, "Unknown DFA core '%s'.\n", argv[i]);
+        usage(argv[0]);
+      }
+    }
+    else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+      nthreads = atoi(argv[++i]);
+      if (nthreads < 1 || nthreads > MAX_THREADS) {
+        fprintf(stderr, "Invalid thread count '%s'. Must be between 1 and %d.\n", argv[i], MAX_THREADS);
+        usage(argv[0]);
+      }
+    }
+    else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+      i++;
+      if (!strcmp(argv[i], "auto")) input = IN_AUTO;
+      else if (!strcmp(argv[i], "mmap")) input = IN_MMAP;
+      else if (!strcmp(argv[i], "stream")) input = IN_STREAM;
+      else if (!strcmp(argv[i], "uring")) input = IN_URING;
+      else if (!strcmp(argv[i], "threads")) input = IN_THREADS;
+      else if (!strcmp(argv[i], "splice")) input = IN_SPLICE;
+      else {
+        fprintf(stderr, "Unknown input mode '%s'.\n", argv[i]);
+        usage(argv[0]);
+      }
+    }
+    else if (!strcmp(argv[i], "--batch")) batch = 1;
+    else if (!strcmp(argv[i], "-r") && i + 2 < argc) {
+      tree_src = argv[++i];
+      tree_dst = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--log") && i + 1 < argc) log = argv[++i];
+    else if (!strcmp(argv[i], "--out-dir") && i + 1 < argc) outdir = argv[++i];
+    else if (!strcmp(argv[i], "--files-from") && i + 1 < argc)
+      paths = readFileList(argv[++i], paths, &npaths, &cap);
+    else if (!strcmp(argv[i], "--serve") && i + 1 < argc) serve = argv[++i];
+    else if (!strcmp(argv[i], "--client") && i + 1 < argc) client = argv[++i];
+    else if (!strcmp(argv[i], "--checkpoint") && i + 1 < argc) index = argv[++i];
+    else if (!strcmp(argv[i], "--checkpoint-every") && i + 1 < argc) {
+      every = parseSize(argv[++i]);
+      if (every == 0) {
+        fprintf(stderr, "Invalid checkpoint distance '%s'.\n", argv[i]);
+        usage(argv[0]);
+      }
+    }
+    else if (!strcmp(argv[i], "--previous") && i + 1 < argc) previous = argv[++i];
+    else if (!strcmp(argv[i], "--edit") && i + 1 < argc) {
+      char *end;
+      i++;
+      edit.start = strtoull(argv[i], &end, 10);
+      int both = end != argv[i] && *end == ','; //the range needs both ends
+      if (both) {
+        char *second = end + 1;
+        edit.end = strtoull(second, &end, 10);
+        both = end != second;
+      }
+      if (!both || *end != '\0' || edit.end < edit.start) {
+        fprintf(stderr, "Invalid edit range '%s'.\n", argv[i]);
+        usage(argv[0]);
+      }
+      edited = 1;
+    }
+    else if (!strcmp(argv[i], "--comments") && i + 1 < argc) comments = argv[++i];
+    else if (!strcmp(argv[i], "-q")) quiet = 1;
+    else if (!strcmp(argv[i], "--stats")) stats = 1;
+    else if (!strcmp(argv[i], "--cache") && i + 1 < argc) cache = argv[++i];
+    else if (!strcmp(argv[i], "--cache-size") && i + 1 < argc) {
+      cache_size = parseSize(argv[++i]);
+      if (cache_size == 0) {
+        fprintf(stderr, "Invalid cache size '%s'.\n", argv[i]);
+        usage(argv[0]);
+      }
+    }
+    else if (argv[i][0] != '-' || argv[i][1] == '\0') { //anything else is an input file
+      if (npaths == cap) {
+        cap = cap ? cap * 2 : 16;
+        paths = realloc(paths, cap * sizeof *paths);
+        if (paths == NULL) {
+          perror("realloc");
+          return EXIT_FAILURE;
         }
-        else
-          putchar(ich); //if input is not '/', output it
-        break;
+      }
+      paths[npaths++] = argv[i];
+    }
+    else usage(argv[0]);
+  }
+  if (initScanner(isa) < 0) {
+    fprintf(stderr, "Scanner '%s' is not supported on this CPU.\n", isa);
+    return EXIT_FAILURE;
+  }
 
-      case QUOTE: //if input is a quote, move to corresponding function
-        handleQuote(&state, ich, cquote_type, &ibackslash); 
-        break;
+  if ((edited || previous) && (!index || !previous || !edited)) {
+    fprintf(stderr, "--edit needs --checkpoint and --previous.\n");
+    usage(argv[0]);
+  }
+  if (index && (serve || batch || nthreads > 1)) usage(argv[0]);
+  if (comments && (serve || batch || index || client || nthreads > 1 || input >= IN_URING))
+    usage(argv[0]);
+  if (comments && decomment != decommentBlock) {
+    fprintf(stderr, "--comments needs the switch core.\n");
+    usage(argv[0]);
+  }
+  if (quiet && (serve || batch || index || client)) usage(argv[0]);
+  if (cache && (serve || batch || index || comments || client)) usage(argv[0]);
+#ifdef DECOMMENT_STATS
+  //the counters are global: one DFA at a time, and only the switch core counts
+  if (stats && (serve || batch || client || cache || nthreads > 1 || input >= IN_URING))
+    usage(argv[0]);
+  if (stats && decomment != decommentBlock) {
+    fprintf(stderr, "--stats needs the switch core.\n");
+    usage(argv[0]);
+  }
+#else
+  if (stats) {
+    fprintf(stderr, "--stats needs a build with the profiling counters (make STATS=1).\n");
+    return EXIT_FAILURE;
+  }
+#endif
+  //the switch core is built for what the run needs: the comment stream, line numbers or neither.
+  //Cached runs keep line numbers even with -q, the entry is also for runs without it
+  if (decomment == decommentBlock && !comments)
+    decomment = (quiet && !cache) ? decommentBlockNoLines : decommentBlockLines;
+  if (serve) {
+    if (batch || client || npaths > 0) usage(argv[0]);
+    return decommentServe(serve, bufsize);
+  }
+  if (tree_src) {
+    if (batch || client || index || comments || quiet || cache || stats || npaths > 0 || outdir)
+      usage(argv[0]);
+    return decommentTree(tree_src, tree_dst, log, nthreads);
+  }
+  if (log) usage(argv[0]);
+  if (batch) {
+    if (outdir == NULL) {
+      fprintf(stderr, "--batch needs --out-dir.\n");
+      usage(argv[0]);
+    }
+    return decommentBatch(paths, npaths, outdir, nthreads, bufsize, input);
+  }
+  if (npaths > 1 || outdir != NULL) usage(argv[0]); //more than one file only makes sense with --batch
+  if (npaths == 1 && strcmp(paths[0], "-")) { //a path reads that file instead of stdin
+    infd = open(paths[0], O_RDONLY);
+    if (infd < 0) {
+      perror(paths[0]);
+      return EXIT_FAILURE;
+    }
+  }
 
-      case WAIT_COMMENT: //if input is /, it could be a comment - move to corresponding function
-        handleWaitComment(&state, ich, line_cur, &line_com); 
-        break;
+  //with a server around, it does the work; $DECOMMENT_SOCKET falls back to working here if it's not
+  const char *env = getenv(SOCKET_ENV);
+  if (client || (env && *env && nthreads == 1 && !index && !comments && !quiet && !cache && !stats)) {
+    int status = decommentClient(client ? client : env, infd, bufsize);
+    if (status >= 0) return status;
+    if (client) {
+      fprintf(stderr, "Cannot connect to the decomment server at '%s'.\n", client);
+      return EXIT_FAILURE;
+    }
+  }
 
-      case SINGLELINE: //if it is a single-line comment, ignore the input until /n is inputted
-        if(ich == '\n'){ //if input is \n, that will be the end of the comment so move back to start
-          printf(" \n");
-          state = START;
-        }
-        break;
+  if (comments) { //comments are written as the DFA passes them
+    com.fd = open(comments, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    com.cap = bufsize;
+    com.buf = malloc(bufsize);
+    if (com.fd < 0 || com.buf == NULL) {
+      perror(comments);
+      return EXIT_FAILURE;
+    }
+  }
+
+  //regular files are mapped, pipes and terminals are streamed (or read whole for -j)
+  size_t n = 0;
+  char *map = (input == IN_STREAM || input >= IN_URING) ? NULL : mapInput(infd, &n, input == IN_MMAP);
+
+  if (cache) { //the input is hashed whole, then either found or decommented into the cache
+    char *in = map ? map : readAll(infd, &n);
+    decommentCached(cache, cache_size, in, n, quiet);
+    if (map) munmap(map, n);
+    else free(in);
+    return(EXIT_SUCCESS);
+  }
+
+  STAT_PHASE(PH_DECOMMENT);
+  if (index) { //the checkpointed runs need all of the input at once
+    char *in = map ? map : readAll(infd, &n);
+    if (edited) decommentEdited(in, n, STDOUT_FILENO, index, previous, &edit, every, &dfa);
+    else decommentCheckpointed(in, n, STDOUT_FILENO, index, every, &dfa);
+    if (!map) free(in);
+  }
+  else if (nthreads > 1) {
+    char *in = map ? map : readAll(infd, &n);
+    decommentParallel(in, n, nthreads, &dfa);
+    if (!map) free(in);
+  }
+  else if (input == IN_SPLICE) { //pipes only, anything else is streamed
+    if (decommentSplice(infd, STDOUT_FILENO, bufsize, &dfa) < 0)
+      decommentStream(infd, STDOUT_FILENO, bufsize, &dfa, NULL);
+  }
+  else if (input >= IN_URING) decommentAsync(infd, STDOUT_FILENO, bufsize, input == IN_URING, &dfa);
+  else if (map) decommentMapped(map, n, STDOUT_FILENO, &dfa, comments ? &com : NULL);
+  else decommentStream(infd, STDOUT_FILENO, bufsize, &dfa, comments ? &com : NULL);
+
+  STAT_PHASE(PH_FINISH);
+  if (map) munmap(map, n);
+  if (comments) {
+    outFlush(&com);
+    close(com.fd);
+  }
+
+  //if it's EOF without closing comment, output error
+  if (!quiet && (dfa.state == MULTILINE || dfa.state == WAIT_END))
+    fprintf(stderr, "Error: line %d: unterminated comment\n", dfa.line_com);
+#ifdef DECOMMENT_STATS
+  if (stats) {
+    STAT_PHASE(PH_FINISH);
+    statsPrint(stderr, &dfa);
+  }
+#endif
+
+  return(EXIT_SUCCESS);
+}
+
+//hands a piece of output from the incremental API to the fd in *arg
+static void writeCallback(void *arg, const char *data, size_t len){
+  writeAll(*(int *)arg, data, len);
+}
+
+//serial mode: reads the input block by block and feeds each block to the incremental API
+static void decommentStream(int fd, int outfd, size_t bufsize, struct DFA *dfa, struct OutBuf *com)
+{
+  struct decomment_ctx ctx;
+  char *in = malloc(bufsize);
+  if (in == NULL || decomment_ctx_init(&ctx, bufsize) < 0) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  ctx.out.com = com;
+
+  while (1) {
+    STAT_BEGIN(PH_READ);
+    ssize_t n = read(fd, in, bufsize);
+    STAT_END();
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("read");
+      exit(EXIT_FAILURE);
+    }
+    if (n == 0) break; //EOF
+
+    decomment_feed(&ctx, in, (size_t)n, writeCallback, &outfd);
+  }
+  decomment_finish(&ctx, writeCallback, &outfd); //stdout is complete before the error message goes out
+  outCommentsEnd(&ctx.dfa, &ctx.out);
+  *dfa = ctx.dfa;
+
+  decomment_ctx_free(&ctx);
+  free(in);
+}
+
+//mmap mode: the whole input is mapped and the DFA runs over it in one go. The output is a list
+//of spans over the mapping with the few bytes the DFA prints itself in between, written with
+//writev(2), so code is never copied in user space.
+static void decommentMapped(const char *in, size_t n, int outfd, struct DFA *dfa, struct OutBuf *com)
+{
+  char bytes[DEFAULT_BUFSIZE];
+  struct iovec iov[IOV_MAX];
+  struct OutBuf out = { outfd, bytes, 0, sizeof bytes, iov, 0, IOV_MAX, NULL, NULL, com };
+
+  decomment(dfa, in, n, &out);
+  outCommentsEnd(dfa, &out);
+  outFlush(&out);
+}
+
+//maps fd if it is a non-empty regular file read from its start, and moves its offset to the end
+//as reading it would. Returns NULL (or exits if required) otherwise: a file that was partly read
+//before (e.g. { head -c 7 >/dev/null; decomment; } < file) is streamed from where it is
+static char *mapInput(int fd, size_t *len, int required){
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+    if (required) {
+      fprintf(stderr, "Input is not a regular file, it cannot be mapped.\n");
+      exit(EXIT_FAILURE);
+    }
+    return NULL;
+  }
+  if (st.st_size == 0) return NULL; //nothing to map, the stream path reads EOF right away
+  if (lseek(fd, 0, SEEK_CUR) != 0) {
+    if (required) {
+      fprintf(stderr, "Input is not read from its start, it cannot be mapped.\n");
+      exit(EXIT_FAILURE);
+    }
+    return NULL;
+  }
+
+  char *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (p == MAP_FAILED) {
+    if (required) {
+      perror("mmap");
+      exit(EXIT_FAILURE);
+    }
+    return NULL;
+  }
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+  lseek(fd, st.st_size, SEEK_SET);
+  *len = st.st_size;
+  return p;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Parallel mode (-j N)
+//
+// The whole input is split into N chunks. The state a chunk starts in is only known once all chunks
+// before it are done, so every chunk is first run speculatively from every state the DFA can be in
+// at a chunk boundary, keeping only the state it ends in (output is discarded). The runs that reach
+// the same state are merged along the way, so usually only two or three of them go all the way.
+// The real entry state of each chunk is then resolved left to right from the table of end states,
+// and a second parallel pass runs each chunk from its real entry state and keeps the output.
+// Newlines are counted in the first pass, so the second pass also knows each chunk's first line
+// and line_com comes out the same as in the serial run.
 
-      case MULTILINE: //if it could be a multi-line comment
-        if(ich == '*') //if it's *, it could be an ending comment - move to WAIT_END
-          state = WAIT_END;
-        else if(ich == '\n'){ //print input only if it's a \n within the comment
-          putchar('\n');
+//every state a chunk can start in. CHAR is never entered by the DFA and is left out.
+static const struct DFA entry_states[] = {
+  { START,        0, -1, 0,    0, 0 },
+  { QUOTE,        0, -1, '\"', 0, 0 },
+  { QUOTE,        0, -1, '\"', 1, 0 },
+  { QUOTE,        0, -1, '\'', 0, 0 },
+  { QUOTE,        0, -1, '\'', 1, 0 },
+  { WAIT_COMMENT, 0, -1, 0,    0, 0 },
+  { SINGLELINE,   0, -1, 0,    0, 0 },
+  { MULTILINE,    0, -1, 0,    0, 0 },
+  { WAIT_END,     0, -1, 0,    0, 0 },
+};
+#define NENTRY ((int)(sizeof entry_states / sizeof entry_states[0]))
+
+// one chunk of the input and what the two passes found out about it
+struct Chunk {
+  const char *in;
+  size_t n;
+  int nl;                    // number of newlines in the chunk
+  enum DFAState exit[NENTRY]; // end state for each entry state (pass 1)
+  char exit_quote[NENTRY];
+  int exit_backslash[NENTRY];
+  struct DFA dfa;            // real entry state before pass 2, end state after it
+  struct OutBuf out;         // output of pass 2
+};
+
+//returns 1 if the DFA will behave the same from a and b (line numbers aside)
+static int sameState(const struct DFA *a, const struct DFA *b){
+  if (a->state != b->state) return 0;
+  if (a->state != QUOTE) return 1; //quote type and backslash only matter inside a quote
+  return a->cquote_type == b->cquote_type && a->ibackslash == b->ibackslash;
+}
+
+//returns the index of the entry state equal to *dfa
+static int entryIndex(const struct DFA *dfa){
+  for (int i = 0; i < NENTRY; i++)
+    if (sameState(dfa, &entry_states[i])) return i;
+  assert(0 && "DFA stopped in a state that is not an entry state");
+  return 0;
+}
+
+//pass 1: runs a chunk from all entry states at once, SPEC_STEP bytes at a time
+static void *speculateChunk(void *arg){
+  struct Chunk *c = arg;
+  struct DFA run[NENTRY]; // the distinct runs still going
+  int which[NENTRY];      // which[i]: the run entry state i has been merged into
+  int nrun = NENTRY;
+  char scratch[4096];
+  struct OutBuf discard = { OUT_DISCARD, scratch, 0, sizeof scratch, NULL, 0, 0, NULL, NULL, NULL };
+
+  for (int i = 0; i < NENTRY; i++) {
+    run[i] = entry_states[i];
+    which[i] = i;
+  }
+
+  for (size_t off = 0; off < c->n; off += SPEC_STEP) {
+    size_t len = c->n - off < SPEC_STEP ? c->n - off : SPEC_STEP;
+    for (int r = 0; r < nrun; r++)
+      decomment(&run[r], c->in + off, len, &discard);
+
+    for (int r = nrun - 1; r > 0; r--) { //merge runs that ended up in the same state
+      for (int q = 0; q < r; q++) {
+        if (!sameState(&run[q], &run[r])) continue;
+        nrun--;
+        for (int i = 0; i < NENTRY; i++) { //r goes into q, the last run moves into slot r
+          if (which[i] == r) which[i] = q;
+          else if (which[i] == nrun) which[i] = r;
         }
+        run[r] = run[nrun];
         break;
+      }
+    }
+  }
 
-      case WAIT_END: //if input is *, it could be end of comment - move to corresponding function
-        handleWaitEnd(&state, ich); 
-        break;
-      default: // safety
-        break;
+  c->nl = run[0].line_cur; //every run counts the same newlines
+  for (int i = 0; i < NENTRY; i++) {
+    c->exit[i] = run[which[i]].state;
+    c->exit_quote[i] = run[which[i]].cquote_type;
+    c->exit_backslash[i] = run[which[i]].ibackslash;
+  }
+  return NULL;
+}
+
+//pass 2: runs a chunk from its real entry state and keeps the output in memory
+static void *decommentChunk(void *arg){
+  struct Chunk *c = arg;
+  c->out.fd = OUT_MEMORY;
+  c->out.cap = c->n + 64; //output is never much longer than the input
+  c->out.len = 0;
+  c->out.buf = malloc(c->out.cap);
+  if (c->out.buf == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  decomment(&c->dfa, c->in, c->n, &c->out);
+  return NULL;
+}
+
+//runs fn on every chunk, one thread per chunk
+static void runChunks(struct Chunk *chunks, int n, void *(*fn)(void *)){
+  pthread_t tid[MAX_THREADS];
+  for (int i = 0; i < n; i++) {
+    int err = pthread_create(&tid[i], NULL, fn, &chunks[i]);
+    if (err) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      exit(EXIT_FAILURE);
     }
+  }
+  for (int i = 0; i < n; i++) pthread_join(tid[i], NULL);
+}
 
-    if (ch == '\n')
-      line_cur++;
+//reads all of fd into one malloc'd buffer
+static char *readAll(int fd, size_t *len){
+  size_t cap = DEFAULT_BUFSIZE, n = 0;
+  char *buf = malloc(cap);
+
+  while (buf != NULL) {
+    if (n == cap) {
+      char *tmp = realloc(buf, cap * 2);
+      if (tmp == NULL) break;
+      buf = tmp;
+      cap *= 2;
+    }
+    STAT_BEGIN(PH_READ);
+    ssize_t r = read(fd, buf + n, cap - n);
+    STAT_END();
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      perror("read");
+      exit(EXIT_FAILURE);
+    }
+    if (r == 0) {
+      *len = n;
+      return buf;
+    }
+    n += r;
   }
-  
-  return(EXIT_SUCCESS);
+  perror("malloc");
+  exit(EXIT_FAILURE);
 }
 
-//handles quotes
-static void handleQuote(enum DFAState *state, int ich, char cquote_type, int *ibackslash){
-  //if input is " again without backslash, string is finished so go back to the start.
-  if(ich == cquote_type && !*ibackslash){
-    putchar(ich); //print the quote
-    *state = START;
+//parallel mode: decomments the whole input in nthreads chunks and writes the output in order
+static void decommentParallel(const char *in, size_t n, int nthreads, struct DFA *dfa)
+{
+  struct Chunk *chunks = calloc(nthreads, sizeof *chunks);
+  if (chunks == NULL) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
   }
-  else if(ich == 92){ //if input is \, handle next input as char
-    putchar(ich);
-    *ibackslash = 1; //indicate that a backslash was used
-  } else if(*ibackslash){ //if a backslash was used before, print input as char
-    putchar(ich);
-    *ibackslash = 0; //revert ibackslash back to 0
+
+  size_t per = n / nthreads;
+  for (int i = 0; i < nthreads; i++) {
+    chunks[i].in = in + i * per;
+    chunks[i].n = (i == nthreads - 1) ? n - i * per : per;
   }
-  else
-    putchar(ich);
+  runChunks(chunks, nthreads, speculateChunk);
+
+  //resolve the real entry state of every chunk from the end state of the one before
+  struct DFA cur = *dfa;
+  for (int i = 0; i < nthreads; i++) {
+    int e = entryIndex(&cur);
+    chunks[i].dfa = cur;
+    chunks[i].dfa.line_com = -1;
+    cur.state = chunks[i].exit[e];
+    cur.cquote_type = chunks[i].exit_quote[e];
+    cur.ibackslash = chunks[i].exit_backslash[e];
+    cur.line_cur += chunks[i].nl;
+  }
+  runChunks(chunks, nthreads, decommentChunk);
+
+  for (int i = 0; i < nthreads; i++) { //the last comment opened in any chunk is the one reported
+    writeAll(STDOUT_FILENO, chunks[i].out.buf, chunks[i].out.len);
+    if (chunks[i].dfa.line_com != -1) dfa->line_com = chunks[i].dfa.line_com;
+    free(chunks[i].out.buf);
+  }
+  dfa->state = chunks[nthreads - 1].dfa.state;
+  dfa->cquote_type = chunks[nthreads - 1].dfa.cquote_type;
+  dfa->ibackslash = chunks[nthreads - 1].dfa.ibackslash;
+  dfa->line_cur = chunks[nthreads - 1].dfa.line_cur;
+
+  free(chunks);
 }
 
-static void handleWaitComment(enum DFAState *state, int ich, int line_cur, int *line_com){
-  if(ich == 47){ //if input is '/' again, it is a single-line comment
-    *state = SINGLELINE;
-    putchar(' '); //replace single line comment with \s
+//--------------------------------------------------------------------------------------------------
+// Batch mode (--batch)
+//
+// Many files are decommented by one process. A pool of worker threads takes the next file from the
+// list; each file is run serially (mapped if possible) into its own output file under the output
+// directory, at the same relative path as the input. The unterminated comment message of a file goes
+// to <output>.err, with the same text the single-file mode prints on stderr.
+
+// the file list shared by the workers and what they found
+struct Batch {
+  const char **paths;
+  int npaths;
+  int next;                     // index of the next file to take (atomic)
+  const char *outdir;
+  size_t bufsize;
+  enum InputMode input;
+  unsigned long long bytes;     // totals (atomic)
+  int done, unterminated, failed;
+};
+
+//creates every missing directory in front of the last '/' of path
+static void makeParents(char *path){
+  for (char *p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+    *p = '\0';
+    if (mkdir(path, 0777) < 0 && errno != EEXIST) perror(path);
+    *p = '/';
   }
-  else if(ich == '*') { //if input is '*', it is a multi-line comment
-    *state = MULTILINE;
-    putchar(' '); //replace multiline comment with \s
-    *line_com = line_cur; //update line_com to be the start of this multiline
+}
+
+//builds outdir/path. Leading '/' and "./" are dropped and ".." becomes "__", so the output
+//always stays inside outdir. Returns -1 if the result does not fit
+static int outputPath(char *dst, size_t size, const char *outdir, const char *path){
+  size_t len = snprintf(dst, size, "%s", outdir);
+
+  while (*path) {
+    const char *e = strchr(path, '/');
+    size_t n = e ? (size_t)(e - path) : strlen(path);
+    if (n == 0 || (n == 1 && path[0] == '.')) { //empty or "." component
+      path += n + (e != NULL);
+      continue;
+    }
+    if (n == 2 && path[0] == '.' && path[1] == '.')
+      len += snprintf(dst + len, len < size ? size - len : 0, "/__");
+    else
+      len += snprintf(dst + len, len < size ? size - len : 0, "/%.*s", (int)n, path);
+    path += n + (e != NULL);
+  }
+  return len < size ? 0 : -1;
+}
+
+//decomments one file of the batch. Returns the number of input bytes, or -1 on error
+static long long batchFile(struct Batch *b, const char *path){
+  char dst[MAX_PATH_LEN], err[MAX_PATH_LEN + 4];
+  struct DFA dfa = DFA_INIT;
+  size_t n = 0;
+
+  if (outputPath(dst, sizeof dst, b->outdir, path) < 0) {
+    fprintf(stderr, "%s: output path too long\n", path);
+    return -1;
+  }
+  snprintf(err, sizeof err, "%s.err", dst);
+
+  int infd = open(path, O_RDONLY);
+  if (infd < 0) {
+    perror(path);
+    return -1;
   }
-  else { //if input was neither * or /, it was not a comment so move to START
-    *state = START; 
-    printf("/%c", ich); //print the char /
+  makeParents(dst);
+  int outfd = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (outfd < 0) {
+    perror(dst);
+    close(infd);
+    return -1;
+  }
+
+  char *map = (b->input == IN_STREAM) ? NULL : mapInput(infd, &n, 0);
+  if (map) {
+    decommentMapped(map, n, outfd, &dfa, NULL);
+    munmap(map, n);
+  } else {
+    decommentStream(infd, outfd, b->bufsize, &dfa, NULL);
+    struct stat st;
+    if (fstat(infd, &st) == 0) n = st.st_size;
   }
+  close(outfd);
+  close(infd);
+
+  unlink(err); //a message from an earlier run must not stay behind
+  if (dfa.state == MULTILINE || dfa.state == WAIT_END) { //if it's EOF without closing comment
+    FILE *fp = fopen(err, "w");
+    if (fp) {
+      fprintf(fp, "Error: line %d: unterminated comment\n", dfa.line_com);
+      fclose(fp);
+    }
+    else perror(err);
+    __atomic_fetch_add(&b->unterminated, 1, __ATOMIC_RELAXED);
+  }
+  return (long long)n;
 }
 
-static void handleWaitEnd(enum DFAState *state, int ich){
-  if(ich == '/'){ //if it's /, end of comment - go back to start
-    *state = START;
+//worker thread: takes files from the list until it is empty
+static void *batchWorker(void *arg){
+  struct Batch *b = arg;
+  int i;
+
+  while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->npaths) {
+    long long n = batchFile(b, b->paths[i]);
+    if (n < 0) __atomic_fetch_add(&b->failed, 1, __ATOMIC_RELAXED);
+    else {
+      __atomic_fetch_add(&b->bytes, (unsigned long long)n, __ATOMIC_RELAXED);
+      __atomic_fetch_add(&b->done, 1, __ATOMIC_RELAXED);
+    }
   }
-  else if(ich == '*') //if it's * again, it could be another end of comment
-    *state = WAIT_END;
-  else{ //if not, it's still inside comment - go back to MULTILINE
-    *state = MULTILINE;
+  return NULL;
+}
+
+//batch mode: decomments all paths with nthreads workers and prints the totals on stderr
+static int decommentBatch(const char **paths, int npaths, const char *outdir, int nthreads,
+                          size_t bufsize, enum InputMode input)
+{
+  struct Batch b = { paths, npaths, 0, outdir, bufsize, input, 0, 0, 0, 0 };
+  pthread_t tid[MAX_THREADS];
+  struct timespec t0, t1;
+
+  if (mkdir(outdir, 0777) < 0 && errno != EEXIST) {
+    perror(outdir);
+    return EXIT_FAILURE;
   }
-}
\ No newline at end of file
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (int i = 0; i < nthreads; i++) {
+    int err = pthread_create(&tid[i], NULL, batchWorker, &b);
+    if (err) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int i = 0; i < nthreads; i++) pthread_join(tid[i], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  fprintf(stderr, "%d file%s, %llu bytes in %.3f s (%.1f MB/s, %.0f files/s), "
+                  "%d unterminated comment%s, %d failed\n",
+                  b.done, b.done == 1 ? "" : "s", b.bytes, secs,
+                  secs > 0 ? b.bytes / secs / 1e6 : 0.0, secs > 0 ? b.done / secs : 0.0,
+                  b.unterminated, b.unterminated == 1 ? "" : "s", b.failed);
+
+  return b.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+//appends the paths listed in file list (one per line, "-" is stdin) to paths
+static const char **readFileList(const char *list, const char **paths, int *npaths, int *cap){
+  FILE *fp = strcmp(list, "-") ? fopen(list, "r") : stdin;
+  char *line = NULL;
+  size_t size = 0;
+  ssize_t len;
+
+  if (fp == NULL) {
+    perror(list);
+    exit(EXIT_FAILURE);
+  }
+  while ((len = getline(&line, &size, fp)) >= 0) {
+    if (len > 0 && line[len - 1] == '\n') line[--len] = '\0';
+    if (len == 0) continue;
+    if (*npaths == *cap) {
+      *cap = *cap ? *cap * 2 : 16;
+      paths = realloc(paths, *cap * sizeof *paths);
+      if (paths == NULL) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+    paths[(*npaths)++] = strdup(line); //kept until exit
+  }
+  free(line);
+  if (fp != stdin) fclose(fp);
+  return paths;
+}
+
+//parses a size like "65536", "64k" or "4M". Returns 0 if it is not a valid size
+static size_t parseSize(const char *s){
+  char *end;
+  errno = 0;
+  unsigned long long v = strtoull(s, &end, 10);
+  if (errno != 0 || end == s) return 0;
+
+  switch (tolower((unsigned char)*end)) {
+    case 'k': v <<= 10; end++; break;
+    case 'm': v <<= 20; end++; break;
+    case 'g': v <<= 30; end++; break;
+    default: break;
+  }
+  if (*end != '\0') return 0;
+  return (size_t)v;
+}
+
+static void usage(const char *argv0){
+  fprintf(stderr, "Usage: %s [-q] [-b bufsize] [-s scanner] [-m core] [-i input] [-j threads] [file]\n"
+                  "       %s [--client socket] [-b bufsize] [file]\n"
+                  "       %s --serve socket [-b bufsize] [-s scanner] [-m core]\n"
+                  "       %s --checkpoint index [--edit start,end --previous output] [file]\n"
+                  "       %s --comments file [-b bufsize] [-s scanner] [-i input] [file]\n"
+                  "       %s --cache dir [--cache-size size] [-q] [-s scanner] [-m core] [file]\n"
+                  "       %s --batch --out-dir dir [-j threads] [--files-from list] [options] [file...]\n"
+                  "       %s -r src dst [--log file] [-j threads] [-s scanner] [-m core]\n"
+                  "Removes comments from C source code read from file (default: standard input).\n"
+                  "\n"
+                  "Options:\n"
+                  " -b bufsize | size of the input/output blocks, e.g. 65536, 64k, 4M (default %d)\n"
+                  " -s scanner | scalar, sse2 or avx2 (default: best one the CPU supports)\n"
+                  " -m core    | switch (default, with the fast-skip scanner) or table (table-driven DFA)\n"
+                  " -i input   | auto (default: mmap regular files, stream anything else), mmap, stream,\n"
+                  "            | uring (reads ahead and writes behind the DFA on io_uring, or on threads\n"
+                  "            | if the kernel has no io_uring), threads (pread/pwrite thread pair) or\n"
+                  "            | splice (input and output pipes: long stretches of code are moved from\n"
+                  "            | one to the other with splice(2), anything else is streamed)\n"
+                  " -j threads | decomment the input in this many chunks in parallel (1-%d);\n"
+                  "            | with --batch or -r, the number of files decommented at the same time\n"
+                  " -q         | do not report an unterminated comment (and do not count lines)\n"
+                  " --stats    | print per-state byte, transition and comment counts and the time of\n"
+                  "            | each phase as JSON on stderr (builds with make STATS=1 only)\n"
+                  "\n"
+                  "Batch mode:\n"
+                  " --batch           | decomment every file into dir/<file>, messages go to dir/<file>.err\n"
+                  " --out-dir dir     | output directory for --batch\n"
+                  " --files-from list | read more input files from list, one per line (- is stdin)\n"
+                  "\n"
+                  "Tree mode:\n"
+                  " -r src dst | decomment every regular file under src into the same path under dst\n"
+                  "            | (symbolic links are not followed); files unchanged since the last run\n"
+                  "            | into dst are skipped\n"
+                  " --log file | where the unterminated comments and errors go (default dst/%s)\n"
+                  "\n"
+                  "Checkpoints:\n"
+                  " --checkpoint index      | write the DFA every N input bytes to the file index\n"
+                  " --checkpoint-every N    | distance between checkpoints, e.g. 64k (default %d)\n"
+                  " --edit start,end        | bytes [start, end) of the input changed since the run that\n"
+                  "                         | wrote index: only decomment from the checkpoint before them\n"
+                  "                         | until the DFA is back in step, and reuse the rest\n"
+                  " --previous output       | output of that run (not the file the new output goes to)\n"
+                  "\n"
+                  "Comments:\n"
+                  " --comments file | also write every comment to file, one per line: the line it starts\n"
+                  "                 | on, its input offset and its text (\\\\ and \\n escaped), tab-separated\n"
+                  "\n"
+                  "Output cache:\n"
+                  " --cache dir        | keep the output of every input in dir, under a hash of the input,\n"
+                  "                    | and print it from there when the same input comes again\n"
+                  " --cache-size size  | remove the least recently used outputs when dir gets larger than\n"
+                  "                    | this, e.g. 1G (default %d)\n"
+                  "\n"
+                  "Server mode:\n"
+                  " --serve socket  | keep running and decomment the input of clients connecting to socket\n"
+                  " --client socket | have the server at socket decomment the input (-b still applies,\n"
+                  "                 | -s, -m and -i are the server's)\n"
+                  "If $%s is set, decomment is a client of the server there when it is running.\n",
+                  argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, DEFAULT_BUFSIZE,
+                  MAX_THREADS, TREE_LOG, DEFAULT_CHECKPOINT_EVERY, DEFAULT_CACHE_SIZE, SOCKET_ENV);
+  exit(EXIT_FAILURE);
+}
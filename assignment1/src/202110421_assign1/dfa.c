@@ -0,0 +1,694 @@
+// 편예빈, Assignment 1, File name: dfa.c
+//
+// The decomment DFA: the switch core with its fast-skip scanners, the table-driven core, the output
+// block both of them write to, and the incremental decomment_ctx API on top. Built into
+// libdecomment.a; decomment.c is the command line driver.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "dfa.h"
+#include "stats.h"
+
+static void outSpan(struct OutBuf *out, const char *p, size_t n);
+static void outEscaped(struct OutBuf *out, const char *p, size_t n);
+static void outCommentStart(struct OutBuf *out, int line, long long offset);
+static void handleQuote(struct DFA *dfa, char ch, struct OutBuf *out);
+static void handleWaitComment(struct DFA *dfa, char ch, struct OutBuf *out);
+static void handleWaitEnd(struct DFA *dfa, char ch);
+
+//--------------------------------------------------------------------------------------------------
+// Fast-skip scanners
+//
+// A scanner returns the first byte in [p, end) that is equal to a, b or c (end if there is none)
+// and adds the number of '\n' bytes it skipped over to *nl. The DFA only has to look at the byte
+// the scanner stops at; the run in front of it is copied (START, QUOTE) or dropped (MULTILINE) in
+// one go. Pass the same character more than once if fewer than three are needed.
+//
+// Each scanner is written once as an always-inlined template with a constant count flag, and built
+// twice: scanXxx counts newlines, findXxx does not (and leaves *nl alone).
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+typedef const char *(*ScanFn)(const char *p, const char *end, char a, char b, char c, int *nl);
+
+static ALWAYS_INLINE const char *scalarT(const char *p, const char *end, char a, char b, char c,
+                                         int *nl, const int count){
+  int lines = 0;
+  for (; p < end; p++) {
+    if (*p == a || *p == b || *p == c) break;
+    if (count && *p == '\n') lines++;
+  }
+  if (count) *nl += lines;
+  return p;
+}
+
+static const char *scanScalar(const char *p, const char *end, char a, char b, char c, int *nl){
+  return scalarT(p, end, a, b, c, nl, 1);
+}
+
+static const char *findScalar(const char *p, const char *end, char a, char b, char c, int *nl){
+  return scalarT(p, end, a, b, c, nl, 0);
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static ALWAYS_INLINE const char *sse2T(const char *p, const char *end, char a, char b, char c,
+                                       int *nl, const int count){
+  const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b), vc = _mm_set1_epi8(c);
+  const __m128i vn = _mm_set1_epi8('\n');
+  int lines = 0;
+
+  while (end - p >= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    unsigned hit = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+                                                                _mm_cmpeq_epi8(v, vb)),
+                                                   _mm_cmpeq_epi8(v, vc)));
+    unsigned nls = count ? _mm_movemask_epi8(_mm_cmpeq_epi8(v, vn)) : 0;
+    if (hit) { //only count the newlines in front of the first hit
+      int k = __builtin_ctz(hit);
+      if (count) *nl += lines + __builtin_popcount(nls & ((1u << k) - 1));
+      return p + k;
+    }
+    if (count) lines += __builtin_popcount(nls);
+    p += 16;
+  }
+  if (count) *nl += lines;
+  return scalarT(p, end, a, b, c, nl, count); //less than one vector left
+}
+
+__attribute__((target("sse2")))
+static const char *scanSSE2(const char *p, const char *end, char a, char b, char c, int *nl){
+  return sse2T(p, end, a, b, c, nl, 1);
+}
+
+__attribute__((target("sse2")))
+static const char *findSSE2(const char *p, const char *end, char a, char b, char c, int *nl){
+  return sse2T(p, end, a, b, c, nl, 0);
+}
+
+__attribute__((target("avx2")))
+static ALWAYS_INLINE const char *avx2T(const char *p, const char *end, char a, char b, char c,
+                                       int *nl, const int count){
+  const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b), vc = _mm256_set1_epi8(c);
+  const __m256i vn = _mm256_set1_epi8('\n');
+  int lines = 0;
+
+  while (end - p >= 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    unsigned hit = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+                                                                                  _mm256_cmpeq_epi8(v, vb)),
+                                                                  _mm256_cmpeq_epi8(v, vc)));
+    unsigned nls = count ? (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vn)) : 0;
+    if (hit) {
+      int k = __builtin_ctz(hit);
+      if (count) *nl += lines + __builtin_popcount(nls & (unsigned)((1ull << k) - 1));
+      return p + k;
+    }
+    if (count) lines += __builtin_popcount(nls);
+    p += 32;
+  }
+  if (count) *nl += lines;
+  return sse2T(p, end, a, b, c, nl, count); //finish the last <32 bytes 16 at a time
+}
+
+__attribute__((target("avx2")))
+static const char *scanAVX2(const char *p, const char *end, char a, char b, char c, int *nl){
+  return avx2T(p, end, a, b, c, nl, 1);
+}
+
+__attribute__((target("avx2")))
+static const char *findAVX2(const char *p, const char *end, char a, char b, char c, int *nl){
+  return avx2T(p, end, a, b, c, nl, 0);
+}
+#endif
+
+static ScanFn scan = scanScalar, find = findScalar; //set once by initScanner()
+static int scan_ready = 0;
+
+CoreFn decomment = decommentBlock;
+
+//picks the scanner: the best one the CPU supports, or the one named by isa ("scalar", "sse2"
+//or "avx2"). Returns -1 if the CPU does not support isa
+int initScanner(const char *isa){
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  int has_avx2 = __builtin_cpu_supports("avx2");
+  int has_sse2 = __builtin_cpu_supports("sse2");
+
+  if (isa == NULL) isa = has_avx2 ? "avx2" : has_sse2 ? "sse2" : "scalar";
+  if (!strcmp(isa, "avx2") && has_avx2) {
+    scan = scanAVX2;
+    find = findAVX2;
+  }
+  else if (!strcmp(isa, "sse2") && has_sse2) {
+    scan = scanSSE2;
+    find = findSSE2;
+  }
+  else if (!strcmp(isa, "scalar")) {
+    scan = scanScalar;
+    find = findScalar;
+  }
+  else return -1;
+#else
+  if (isa != NULL && strcmp(isa, "scalar")) return -1;
+  scan = scanScalar;
+  find = findScalar;
+#endif
+  scan_ready = 1;
+  return 0;
+}
+
+//runs the DFA over one block of input. All state lives in *dfa, so a comment or
+//string may start in one block and end in the next. In the states that usually last long
+//(START, QUOTE, SINGLELINE, MULTILINE) the scanner skips to the next byte that can change
+//the state, and only that byte goes through the switch.
+//lines and comments are constants in each build of it (see DEFINE_CORE below): without lines,
+//line_cur and line_com are not kept up to date; without comments, out->com is ignored.
+static ALWAYS_INLINE void decommentCore(struct DFA *dfa, const char *in, size_t n,
+                                        struct OutBuf *out, const int lines, const int comments)
+{
+  const char *p = in, *end = in + n;
+
+  while (p < end) {
+    const char *run = p;
+    int nl = 0;
+
+    switch(dfa->state) { //fast-skip the run of bytes the current state ignores or just copies
+      case START: //plain code is copied up to the next '/' or quote
+        p = lines ? scan(p, end, '/', '\"', '\'', &dfa->line_cur) : find(p, end, '/', '\"', '\'', &nl);
+        outWrite(out, run, p - run);
+        break;
+      case QUOTE: //string contents are copied up to the next closing quote or backslash
+        if (!dfa->ibackslash) {
+          p = lines ? scan(p, end, dfa->cquote_type, 92, dfa->cquote_type, &dfa->line_cur)
+                    : find(p, end, dfa->cquote_type, 92, dfa->cquote_type, &nl);
+          outWrite(out, run, p - run);
+        }
+        break;
+      case SINGLELINE: //comment text is dropped up to the end of the line (no newlines to count)
+        p = find(p, end, '\n', '\n', '\n', &nl);
+        if (comments && out->com) outEscaped(out->com, run, p - run);
+        break;
+      case MULTILINE: //comment text is dropped up to the next '*', but its newlines are kept
+        p = scan(p, end, '*', '*', '*', &nl);
+        if (comments && out->com) outEscaped(out->com, run, p - run);
+        outRepeat(out, '\n', nl);
+        if (lines) dfa->line_cur += nl;
+        break;
+      default:
+        break;
+    }
+    STAT_RUN(dfa->state, p - run);
+    if (p == end) break;
+
+    char ch = *p;
+#ifdef DECOMMENT_STATS
+    enum DFAState from = dfa->state;
+#endif
+
+    switch(dfa->state) {
+      case START: //if state is START
+        if(ch == '/') //if input is '/', wait to see if it is a comment
+          dfa->state = WAIT_COMMENT;
+        else if(ch == '\"' || ch == '\''){ //if input is a quote, change to QUOTE state
+          dfa->cquote_type = ch; //indicate which quote was used (single or double)
+          outByte(out, ch);
+          dfa->state = QUOTE;
+        }
+        else
+          outByte(out, ch); //if input is not '/', output it
+        break;
+
+      case QUOTE: //if input is a quote, move to corresponding function
+        handleQuote(dfa, ch, out);
+        break;
+
+      case WAIT_COMMENT: //if input is /, it could be a comment - move to corresponding function
+        handleWaitComment(dfa, ch, out);
+        if (comments && out->com && (dfa->state == SINGLELINE || dfa->state == MULTILINE)) //a comment starts
+          outCommentStart(out->com, dfa->line_cur, dfa->in_off + (p - in) - 1);
+        break;
+
+      case SINGLELINE: //if it is a single-line comment, ignore the input until /n is inputted
+        if(ch == '\n'){ //if input is \n, that will be the end of the comment so move back to start
+          outWrite(out, " \n", 2);
+          dfa->state = START;
+          if (comments && out->com) outByte(out->com, '\n');
+        }
+        else if (comments && out->com) outEscaped(out->com, p, 1);
+        break;
+
+      case MULTILINE: //if it could be a multi-line comment
+        if(ch == '*') //if it's *, it could be an ending comment - move to WAIT_END
+          dfa->state = WAIT_END;
+        else if(ch == '\n'){ //print input only if it's a \n within the comment
+          outByte(out, '\n');
+        }
+        if (comments && out->com && ch != '*') outEscaped(out->com, p, 1);
+        break;
+
+      case WAIT_END: //if input is *, it could be end of comment - move to corresponding function
+        handleWaitEnd(dfa, ch);
+        if (comments && out->com) { //the '*' before ch was part of the comment unless ch ends it
+          if (dfa->state == START) outByte(out->com, '\n');
+          else outByte(out->com, '*');
+          if (dfa->state == MULTILINE) outEscaped(out->com, p, 1);
+        }
+        break;
+      default: // safety
+        break;
+    }
+
+    STAT_STEP(dfa, from, dfa->in_off + (p - in));
+    if (lines && ch == '\n')
+      dfa->line_cur++;
+    p++;
+  }
+  dfa->in_off += n;
+}
+
+//the builds of the switch core: each one only pays for what it keeps track of
+#define DEFINE_CORE(name, lines, comments)                                        \
+  void name(struct DFA *dfa, const char *in, size_t n, struct OutBuf *out){       \
+    decommentCore(dfa, in, n, out, lines, comments);                              \
+  }
+
+DEFINE_CORE(decommentBlock, 1, 1)        //line numbers and the comment stream
+DEFINE_CORE(decommentBlockLines, 1, 0)   //line numbers for the unterminated comment message
+DEFINE_CORE(decommentBlockNoLines, 0, 0) //output only
+
+//handles quotes
+static void handleQuote(struct DFA *dfa, char ch, struct OutBuf *out){
+  //if input is " again without backslash, string is finished so go back to the start.
+  if(ch == dfa->cquote_type && !dfa->ibackslash){
+    outByte(out, ch); //print the quote
+    dfa->state = START;
+  }
+  else if(ch == 92){ //if input is \, handle next input as char
+    outByte(out, ch);
+    dfa->ibackslash = 1; //indicate that a backslash was used
+  } else if(dfa->ibackslash){ //if a backslash was used before, print input as char
+    outByte(out, ch);
+    dfa->ibackslash = 0; //revert ibackslash back to 0
+  }
+  else
+    outByte(out, ch);
+}
+
+static void handleWaitComment(struct DFA *dfa, char ch, struct OutBuf *out){
+  if(ch == 47){ //if input is '/' again, it is a single-line comment
+    dfa->state = SINGLELINE;
+    outByte(out, ' '); //replace single line comment with \s
+  }
+  else if(ch == '*') { //if input is '*', it is a multi-line comment
+    dfa->state = MULTILINE;
+    outByte(out, ' '); //replace multiline comment with \s
+    dfa->line_com = dfa->line_cur; //update line_com to be the start of this multiline
+  }
+  else { //if input was neither * or /, it was not a comment so move to START
+    dfa->state = START;
+    outByte(out, '/'); //print the char /
+    outByte(out, ch);
+  }
+}
+
+static void handleWaitEnd(struct DFA *dfa, char ch){
+  if(ch == '/'){ //if it's /, end of comment - go back to start
+    dfa->state = START;
+  }
+  else if(ch == '*') //if it's * again, it could be another end of comment
+    dfa->state = WAIT_END;
+  else{ //if not, it's still inside comment - go back to MULTILINE
+    dfa->state = MULTILINE;
+  }
+}
+
+//--------------------------------------------------------------------------------------------------
+// Table-driven DFA (-m table)
+//
+// The same DFA as decommentBlock() and the handle*() functions, written as two constant tables that
+// the compiler builds: char_class maps every byte to one of a few classes, and dfa_table gives the
+// next state and the output action for each (state, class) pair. QUOTE is split into one table state
+// per quote type and backslash flag, so the table alone decides everything. The switch version stays
+// as the reference (-m switch).
+
+enum CharClass {C_OTHER, C_SLASH, C_STAR, C_DQUOTE, C_SQUOTE, C_BACKSLASH, C_NEWLINE, NCLASS};
+
+enum TableState {
+  T_START, T_DQUOTE, T_DQUOTE_BS, T_SQUOTE, T_SQUOTE_BS,
+  T_WAIT_COMMENT, T_SINGLELINE, T_MULTILINE, T_WAIT_END, T_CHAR, NTSTATE
+};
+
+enum Action {
+  A_NONE,       // print nothing
+  A_COPY,       // print the input byte
+  A_SPACE,      // print ' ' (a single-line comment starts)
+  A_OPEN,       // print ' ' and remember the line (a multi-line comment starts)
+  A_SLASH,      // print '/' and the input byte (it was not a comment)
+  A_SPACE_NL    // print " \n" (a single-line comment ends)
+};
+
+#define TE(next, action) ((unsigned char)((action) << 4 | (next)))
+#define T_NEXT(e) ((e) & 0xf)
+#define T_ACTION(e) ((e) >> 4)
+
+static const unsigned char char_class[256] = {
+  ['/'] = C_SLASH, ['*'] = C_STAR, ['\"'] = C_DQUOTE, ['\''] = C_SQUOTE,
+  [92] = C_BACKSLASH, ['\n'] = C_NEWLINE,
+};
+
+//a quote state: copies everything, the own quote closes it unless a backslash came before it
+#define QUOTE_ROW(self, bs, closer) {                                       \
+  [C_OTHER] = TE(self, A_COPY),     [C_SLASH] = TE(self, A_COPY),          \
+  [C_STAR] = TE(self, A_COPY),      [C_NEWLINE] = TE(self, A_COPY),        \
+  [C_DQUOTE] = TE(closer == C_DQUOTE ? T_START : self, A_COPY),           \
+  [C_SQUOTE] = TE(closer == C_SQUOTE ? T_START : self, A_COPY),           \
+  [C_BACKSLASH] = TE(bs, A_COPY) }
+#define QUOTE_BS_ROW(plain, self) {                                         \
+  [C_OTHER] = TE(plain, A_COPY),    [C_SLASH] = TE(plain, A_COPY),         \
+  [C_STAR] = TE(plain, A_COPY),     [C_NEWLINE] = TE(plain, A_COPY),       \
+  [C_DQUOTE] = TE(plain, A_COPY),   [C_SQUOTE] = TE(plain, A_COPY),        \
+  [C_BACKSLASH] = TE(self, A_COPY) }
+//a state that ignores every class except one
+#define ROW_ALL(next, action) {                                             \
+  TE(next, action), TE(next, action), TE(next, action), TE(next, action),  \
+  TE(next, action), TE(next, action), TE(next, action) }
+
+static const unsigned char dfa_table[NTSTATE][NCLASS] = {
+  [T_START] = {
+    [C_OTHER] = TE(T_START, A_COPY),        [C_SLASH] = TE(T_WAIT_COMMENT, A_NONE),
+    [C_STAR] = TE(T_START, A_COPY),         [C_DQUOTE] = TE(T_DQUOTE, A_COPY),
+    [C_SQUOTE] = TE(T_SQUOTE, A_COPY),      [C_BACKSLASH] = TE(T_START, A_COPY),
+    [C_NEWLINE] = TE(T_START, A_COPY) },
+  [T_DQUOTE] = QUOTE_ROW(T_DQUOTE, T_DQUOTE_BS, C_DQUOTE),
+  [T_DQUOTE_BS] = QUOTE_BS_ROW(T_DQUOTE, T_DQUOTE_BS),
+  [T_SQUOTE] = QUOTE_ROW(T_SQUOTE, T_SQUOTE_BS, C_SQUOTE),
+  [T_SQUOTE_BS] = QUOTE_BS_ROW(T_SQUOTE, T_SQUOTE_BS),
+  [T_WAIT_COMMENT] = {
+    [C_OTHER] = TE(T_START, A_SLASH),       [C_SLASH] = TE(T_SINGLELINE, A_SPACE),
+    [C_STAR] = TE(T_MULTILINE, A_OPEN),     [C_DQUOTE] = TE(T_START, A_SLASH),
+    [C_SQUOTE] = TE(T_START, A_SLASH),      [C_BACKSLASH] = TE(T_START, A_SLASH),
+    [C_NEWLINE] = TE(T_START, A_SLASH) },
+  [T_SINGLELINE] = {
+    [C_OTHER] = TE(T_SINGLELINE, A_NONE),   [C_SLASH] = TE(T_SINGLELINE, A_NONE),
+    [C_STAR] = TE(T_SINGLELINE, A_NONE),    [C_DQUOTE] = TE(T_SINGLELINE, A_NONE),
+    [C_SQUOTE] = TE(T_SINGLELINE, A_NONE),  [C_BACKSLASH] = TE(T_SINGLELINE, A_NONE),
+    [C_NEWLINE] = TE(T_START, A_SPACE_NL) },
+  [T_MULTILINE] = {
+    [C_OTHER] = TE(T_MULTILINE, A_NONE),    [C_SLASH] = TE(T_MULTILINE, A_NONE),
+    [C_STAR] = TE(T_WAIT_END, A_NONE),      [C_DQUOTE] = TE(T_MULTILINE, A_NONE),
+    [C_SQUOTE] = TE(T_MULTILINE, A_NONE),   [C_BACKSLASH] = TE(T_MULTILINE, A_NONE),
+    [C_NEWLINE] = TE(T_MULTILINE, A_COPY) },
+  [T_WAIT_END] = { //a '\n' right after '*' is not printed
+    [C_OTHER] = TE(T_MULTILINE, A_NONE),    [C_SLASH] = TE(T_START, A_NONE),
+    [C_STAR] = TE(T_WAIT_END, A_NONE),      [C_DQUOTE] = TE(T_MULTILINE, A_NONE),
+    [C_SQUOTE] = TE(T_MULTILINE, A_NONE),   [C_BACKSLASH] = TE(T_MULTILINE, A_NONE),
+    [C_NEWLINE] = TE(T_MULTILINE, A_NONE) },
+  [T_CHAR] = ROW_ALL(T_CHAR, A_NONE),
+};
+
+//maps the DFA state onto a table state
+static int toTableState(const struct DFA *dfa){
+  switch (dfa->state) {
+    case START:        return T_START;
+    case QUOTE:
+      if (dfa->cquote_type == '\"') return dfa->ibackslash ? T_DQUOTE_BS : T_DQUOTE;
+      return dfa->ibackslash ? T_SQUOTE_BS : T_SQUOTE;
+    case WAIT_COMMENT: return T_WAIT_COMMENT;
+    case SINGLELINE:   return T_SINGLELINE;
+    case MULTILINE:    return T_MULTILINE;
+    case WAIT_END:     return T_WAIT_END;
+    default:           return T_CHAR;
+  }
+}
+
+//maps a table state back onto the DFA state
+static void fromTableState(struct DFA *dfa, int ts){
+  static const enum DFAState states[NTSTATE] = {
+    [T_START] = START, [T_DQUOTE] = QUOTE, [T_DQUOTE_BS] = QUOTE, [T_SQUOTE] = QUOTE,
+    [T_SQUOTE_BS] = QUOTE, [T_WAIT_COMMENT] = WAIT_COMMENT, [T_SINGLELINE] = SINGLELINE,
+    [T_MULTILINE] = MULTILINE, [T_WAIT_END] = WAIT_END, [T_CHAR] = CHAR,
+  };
+  dfa->state = states[ts];
+  if (ts == T_DQUOTE || ts == T_DQUOTE_BS) dfa->cquote_type = '\"';
+  if (ts == T_SQUOTE || ts == T_SQUOTE_BS) dfa->cquote_type = '\'';
+  dfa->ibackslash = (ts == T_DQUOTE_BS || ts == T_SQUOTE_BS);
+}
+
+//runs the table-driven DFA over one block of input. Output goes straight into the output block;
+//the input is cut into pieces so that every piece fits even if each byte prints two.
+void decommentTable(struct DFA *dfa, const char *in, size_t n, struct OutBuf *out)
+{
+  const unsigned char *p = (const unsigned char *)in, *end = p + n;
+  int ts = toTableState(dfa);
+  int line_cur = dfa->line_cur;
+
+  while (p < end) {
+    size_t room = (out->cap - out->len) / 2;
+    if (room == 0 || (out->iov && out->niov == out->maxiov)) {
+      outFlush(out);
+      continue;
+    }
+    const unsigned char *stop = (size_t)(end - p) < room ? end : p + room;
+    char *o = out->buf + out->len;
+
+    for (; p < stop; p++) {
+      unsigned char e = dfa_table[ts][char_class[*p]];
+      int action = T_ACTION(e);
+      ts = T_NEXT(e);
+      *o = (char)*p;            //A_COPY, the common case, costs no branch:
+      o += (action == A_COPY);  //the byte is always stored and only kept when copied
+      if (action > A_COPY) {
+        switch (action) {
+          case A_OPEN:
+            dfa->line_com = line_cur;
+            /* fall through */
+          case A_SPACE:
+            *o++ = ' ';
+            break;
+          case A_SLASH:
+            *o++ = '/';
+            *o++ = (char)*p;
+            break;
+          case A_SPACE_NL:
+            *o++ = ' ';
+            *o++ = '\n';
+            break;
+        }
+      }
+      line_cur += (*p == '\n');
+    }
+    if (out->iov) outSpan(out, out->buf + out->len, o - (out->buf + out->len));
+    out->len = o - out->buf;
+  }
+
+  dfa->line_cur = line_cur;
+  dfa->in_off += n;
+  fromTableState(dfa, ts);
+}
+
+//writes n bytes to fd. write(2) may write less than asked, keep going until all is out
+void writeAll(int fd, const char *p, size_t n){
+  STAT_BEGIN(PH_WRITE);
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+    p += w;
+    n -= w;
+  }
+  STAT_END();
+}
+
+//writes n iovecs to fd, picking up where a short writev(2) stopped
+void writevAll(int fd, struct iovec *iov, int n){
+  STAT_BEGIN(PH_WRITE);
+  while (n > 0) {
+    ssize_t w = writev(fd, iov, n);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      perror("writev");
+      exit(EXIT_FAILURE);
+    }
+    while (n > 0 && (size_t)w >= iov->iov_len) { //skip what was written completely
+      w -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+  STAT_END();
+}
+
+//writes the collected output block to the output fd (or hands it to the callback)
+void outFlush(struct OutBuf *out){
+  if (out->fd == OUT_CALLBACK) {
+    if (out->len > 0) out->cb(out->cb_arg, out->buf, out->len);
+    out->len = 0;
+    return;
+  }
+  if (out->iov) { //span mode: the spans and the bytes in buf go out in one writev
+    writevAll(out->fd, out->iov, out->niov);
+    out->niov = 0;
+    out->len = 0;
+    return;
+  }
+  if (out->fd == OUT_MEMORY) { //in-memory output grows instead of being written
+    if (out->len < out->cap) return;
+    char *tmp = realloc(out->buf, out->cap * 2);
+    if (tmp == NULL) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    out->buf = tmp;
+    out->cap *= 2;
+    return;
+  }
+  if (out->fd >= 0) writeAll(out->fd, out->buf, out->len);
+  out->len = 0;
+}
+
+//span mode: records n bytes at p as the next piece of output, merging it with the last span
+//if the two are adjacent
+static void outSpan(struct OutBuf *out, const char *p, size_t n){
+  if (n == 0) return;
+  if (out->niov > 0) {
+    struct iovec *last = &out->iov[out->niov - 1];
+    if ((const char *)last->iov_base + last->iov_len == p) {
+      last->iov_len += n;
+      return;
+    }
+  }
+  if (out->niov == out->maxiov) outFlush(out);
+  out->iov[out->niov].iov_base = (void *)p;
+  out->iov[out->niov].iov_len = n;
+  out->niov++;
+}
+
+//appends a span of n bytes to the output block
+void outWrite(struct OutBuf *out, const char *p, size_t n){
+  if (out->fd == OUT_DISCARD) return;
+  if (out->iov) {
+    outSpan(out, p, n);
+    return;
+  }
+  while (n > 0) {
+    if (out->len == out->cap) outFlush(out);
+    size_t room = out->cap - out->len;
+    if (room > n) room = n;
+    memcpy(out->buf + out->len, p, room);
+    out->len += room;
+    p += room;
+    n -= room;
+  }
+}
+
+void outByte(struct OutBuf *out, char c){
+  if (out->len == out->cap || (out->iov && out->niov == out->maxiov)) outFlush(out);
+  out->buf[out->len++] = c;
+  if (out->iov) outSpan(out, &out->buf[out->len - 1], 1);
+}
+
+//appends n copies of c to the output block
+void outRepeat(struct OutBuf *out, char c, size_t n){
+  if (out->fd == OUT_DISCARD) return;
+  while (n > 0) {
+    if (out->len == out->cap || (out->iov && out->niov == out->maxiov)) outFlush(out);
+    size_t room = out->cap - out->len;
+    if (room > n) room = n;
+    memset(out->buf + out->len, c, room);
+    if (out->iov) outSpan(out, out->buf + out->len, room);
+    out->len += room;
+    n -= room;
+  }
+}
+
+//comment stream: writes comment text with '\\' and newlines escaped, so a comment stays on one line
+static void outEscaped(struct OutBuf *out, const char *p, size_t n){
+  const char *end = p + n;
+  while (p < end) {
+    const char *run = p;
+    while (p < end && *p != '\\' && *p != '\n') p++;
+    outWrite(out, run, p - run);
+    if (p == end) break;
+    outByte(out, '\\');
+    outByte(out, *p == '\n' ? 'n' : '\\');
+    p++;
+  }
+}
+
+//comment stream: starts the line of a comment opened on line at input offset
+static void outCommentStart(struct OutBuf *out, int line, long long offset){
+  char head[48];
+  int n = snprintf(head, sizeof head, "%d\t%lld\t", line, offset);
+  outWrite(out, head, n);
+}
+
+//comment stream: ends the line of a comment left open at the end of the input
+void outCommentsEnd(const struct DFA *dfa, struct OutBuf *out){
+  if (out->com == NULL) return;
+  if (dfa->state == WAIT_END) outByte(out->com, '*'); //no '/' came after it
+  if (dfa->state == SINGLELINE || dfa->state == MULTILINE || dfa->state == WAIT_END)
+    outByte(out->com, '\n');
+}
+
+//--------------------------------------------------------------------------------------------------
+// Incremental API
+//
+// The context carries the DFA state and one output block from one decomment_feed() to the next, so
+// input can come in pieces of any size. The output block is allocated once by decomment_ctx_init();
+// feeding and finishing allocate nothing.
+
+//sets up ctx for a new input. Returns -1 if the output block cannot be allocated
+int decomment_ctx_init(struct decomment_ctx *ctx, size_t bufsize){
+  struct DFA start = DFA_INIT;
+
+  if (!scan_ready) initScanner(NULL);
+  if (bufsize < 16) bufsize = 16; //decommentTable needs room for at least a few bytes
+  ctx->dfa = start;
+  memset(&ctx->out, 0, sizeof ctx->out);
+  ctx->out.fd = OUT_CALLBACK;
+  ctx->out.cap = bufsize;
+  ctx->out.buf = malloc(bufsize);
+  return ctx->out.buf ? 0 : -1;
+}
+
+//runs the DFA over the next len bytes of input. Output is handed to out_cb (with arg) in one or
+//more pieces, all of them before decomment_feed() returns
+void decomment_feed(struct decomment_ctx *ctx, const char *in, size_t len,
+                    decomment_out_fn out_cb, void *arg){
+  ctx->out.cb = out_cb;
+  ctx->out.cb_arg = arg;
+  decomment(&ctx->dfa, in, len, &ctx->out);
+  outFlush(&ctx->out);
+}
+
+//ends the input. Returns the line of the unterminated comment, or 0 if all comments were closed
+int decomment_finish(struct decomment_ctx *ctx, decomment_out_fn out_cb, void *arg){
+  ctx->out.cb = out_cb;
+  ctx->out.cb_arg = arg;
+  outFlush(&ctx->out);
+  //if it's EOF without closing comment, the comment that is open started at line_com
+  if (ctx->dfa.state == MULTILINE || ctx->dfa.state == WAIT_END) return ctx->dfa.line_com;
+  return 0;
+}
+
+//frees the output block. ctx can be set up again with decomment_ctx_init()
+void decomment_ctx_free(struct decomment_ctx *ctx){
+  free(ctx->out.buf);
+  ctx->out.buf = NULL;
+}
@@ -0,0 +1,95 @@
+// 편예빈, Assignment 1, File name: dfa.h
+//
+// The decomment DFA as a library (libdecomment.a).
+//
+// Incremental use: set up a struct decomment_ctx with decomment_ctx_init(), call decomment_feed()
+// for every piece of input as it arrives, and decomment_finish() at the end of the input.
+//
+// The lower-level interface below it (struct DFA, struct OutBuf and the core functions) is what
+// the decomment driver uses for its mmap, parallel and batch modes.
+
+#ifndef _DFA_H_
+#define _DFA_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define DEFAULT_BUFSIZE (1 << 16) // default size of the input and output blocks (64 KiB)
+
+#define OUT_DISCARD  -1           // OutBuf.fd: output is thrown away
+#define OUT_MEMORY   -2           // OutBuf.fd: output is kept in a buffer that grows as needed
+#define OUT_CALLBACK -3           // OutBuf.fd: output is handed to OutBuf.cb
+
+enum DFAState {START, QUOTE, CHAR, WAIT_COMMENT, SINGLELINE, MULTILINE, WAIT_END};
+
+// everything the DFA needs to carry from one input block to the next
+struct DFA {
+  enum DFAState state;
+  // line_cur & line_com: current line number and comment line number
+  int line_cur, line_com;
+  //char that specifies if the prev input was a single ' or double quote "
+  char cquote_type;
+  // int that specifies if prev input was a backslash \ or not
+  int ibackslash;
+  // number of input bytes run through so far (offset of a comment in the comment stream)
+  long long in_off;
+};
+
+#define DFA_INIT { START, 1, -1, 0, 0, 0 } // the DFA at the start of the input
+
+// receives a piece of output (OUT_CALLBACK and the incremental API)
+typedef void (*decomment_out_fn)(void *arg, const char *data, size_t len);
+
+// output block: spans are collected here and written with one write(2) when it fills up.
+// fd may also be OUT_DISCARD, OUT_MEMORY or OUT_CALLBACK.
+// If iov is set, spans are not copied but recorded as iovecs pointing at the input (which has to
+// stay mapped until the flush); buf then only holds the bytes the DFA prints itself.
+// If com is set, decommentBlock also writes every comment to it, one line per comment:
+//   <line>\t<offset>\t<body>\n
+// line is the line the comment starts on, offset the input offset of its first '/', body the text
+// between the comment markers with '\\' written as "\\\\" and newlines as "\\n".
+struct OutBuf {
+  int fd;
+  char *buf;
+  size_t len, cap;
+  struct iovec *iov;
+  int niov, maxiov;
+  decomment_out_fn cb;
+  void *cb_arg;
+  struct OutBuf *com;
+};
+
+//the DFA cores: run the DFA over n bytes of input, continuing from and updating *dfa.
+//decommentBlock is built three times from one source: decommentBlock keeps the line numbers and
+//writes the comment stream (OutBuf.com), decommentBlockLines only keeps the line numbers, and
+//decommentBlockNoLines keeps neither (line_cur and line_com mean nothing after it).
+typedef void (*CoreFn)(struct DFA *dfa, const char *in, size_t n, struct OutBuf *out);
+void decommentBlock(struct DFA *dfa, const char *in, size_t n, struct OutBuf *out);
+void decommentBlockLines(struct DFA *dfa, const char *in, size_t n, struct OutBuf *out);
+void decommentBlockNoLines(struct DFA *dfa, const char *in, size_t n, struct OutBuf *out);
+void decommentTable(struct DFA *dfa, const char *in, size_t n, struct OutBuf *out);
+extern CoreFn decomment; //the core in use, decommentBlock unless changed
+
+int initScanner(const char *isa);
+
+void writeAll(int fd, const char *p, size_t n);
+void writevAll(int fd, struct iovec *iov, int n);
+void outFlush(struct OutBuf *out);
+void outWrite(struct OutBuf *out, const char *p, size_t n);
+void outByte(struct OutBuf *out, char c);
+void outRepeat(struct OutBuf *out, char c, size_t n);
+void outCommentsEnd(const struct DFA *dfa, struct OutBuf *out);
+
+// incremental API
+struct decomment_ctx {
+  struct DFA dfa;
+  struct OutBuf out;
+};
+
+int decomment_ctx_init(struct decomment_ctx *ctx, size_t bufsize);
+void decomment_feed(struct decomment_ctx *ctx, const char *in, size_t len,
+                    decomment_out_fn out_cb, void *arg);
+int decomment_finish(struct decomment_ctx *ctx, decomment_out_fn out_cb, void *arg);
+void decomment_ctx_free(struct decomment_ctx *ctx);
+
+#endif
@@ -0,0 +1,214 @@
+// 편예빈, Assignment 1, File name: passthrough.c
+//
+// Pipe passthrough. The input pipe is never read directly: tee(2) duplicates the next block of it
+// into a private pipe, and only that copy is read into user space, where the DFA runs over it in
+// span mode. The input itself is still in the input pipe, so each span of the output that is a
+// long enough stretch of input is then moved from the input pipe to the output pipe with splice(2),
+// without being copied again. Everything else is written as usual, and the input bytes that were
+// not spliced are dropped into /dev/null with splice(2).
+//
+// Every byte is still read once, from the tee(2) copy: the DFA has to see it to know where the
+// comments are (with the switch core it only stops at '/', '"' and '\'', the scanner skips the
+// rest). What splicing saves is the copy into the output, so it only pays off when the input has
+// stretches without comments that are much longer than SPLICE_MIN. With code that has a comment
+// every few lines, tee(2), splice(2) and the extra read cost more than they save, and -i stream is
+// as fast or faster.
+//
+// If the kernel refuses a splice, the bytes are copied from then on (read(2) and write(2)); if
+// tee(2) does not work on the first block, decommentSplice() returns before touching the input.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "dfa.h"
+#include "passthrough.h"
+
+// the pipes and how the bytes are moved between them
+struct Pipes {
+  int in, out;                    // input and output pipe
+  int peek[2];                    // tee(2) copies of the input are read back through this pipe
+  int null;                       // /dev/null, where input that is not spliced goes
+  int can_splice;                 // cleared when the kernel refuses a splice: copy from then on
+  char *drop;                     // input is read into this when it cannot be spliced away
+  size_t dropsize;
+  char *stage;                    // output between two splices is gathered here and written at once
+};
+
+//copies the next (up to len) bytes of the input pipe into buf without taking them out of it.
+//Returns the number of bytes, 0 at the end of the input, -1 if tee(2) does not work here
+static ssize_t peekInput(struct Pipes *pp, char *buf, size_t len){
+  ssize_t n;
+  while ((n = tee(pp->in, pp->peek[1], len, 0)) < 0 && errno == EINTR);
+  if (n <= 0) return n;
+
+  for (ssize_t got = 0; got < n; ) {
+    ssize_t r = read(pp->peek[0], buf + got, n - got);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) {
+      perror("read");
+      exit(EXIT_FAILURE);
+    }
+    got += r;
+  }
+  return n;
+}
+
+//takes the next len bytes out of the input pipe and throws them away
+static void dropInput(struct Pipes *pp, size_t len){
+  while (len > 0) {
+    ssize_t r;
+    if (pp->can_splice) r = splice(pp->in, NULL, pp->null, NULL, len, 0);
+    else r = read(pp->in, pp->drop, len < pp->dropsize ? len : pp->dropsize);
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0 && pp->can_splice && errno == EINVAL) {
+      pp->can_splice = 0;
+      continue;
+    }
+    if (r <= 0) {
+      perror("read");
+      exit(EXIT_FAILURE);
+    }
+    len -= r;
+  }
+}
+
+//moves the next len bytes of the input pipe to the output pipe. copy is the same bytes, written
+//instead if splicing does not work
+static void passInput(struct Pipes *pp, const char *copy, size_t len){
+  while (len > 0 && pp->can_splice) {
+    ssize_t r = splice(pp->in, NULL, pp->out, NULL, len, SPLICE_F_MOVE);
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0 && errno == EINVAL) {
+      pp->can_splice = 0;
+      break;
+    }
+    if (r <= 0) {
+      perror("splice");
+      exit(EXIT_FAILURE);
+    }
+    copy += r;
+    len -= r;
+  }
+  if (len > 0) {
+    dropInput(pp, len);
+    writeAll(pp->out, copy, len);
+  }
+}
+
+//writes n iovecs. They are mostly short, so they are gathered into one buffer (which holds the
+//whole output of a block) and written with one write(2), like the stream path does
+static void writeSpans(struct Pipes *pp, const struct iovec *iov, int n){
+  size_t len = 0;
+  for (int i = 0; i < n; i++) {
+    memcpy(pp->stage + len, iov[i].iov_base, iov[i].iov_len);
+    len += iov[i].iov_len;
+  }
+  writeAll(pp->out, pp->stage, len);
+}
+
+//sends the output of one block: runs of output that are a stretch of the input at least SPLICE_MIN
+//long are spliced, the rest is written, and the input pipe is advanced past the n bytes the block
+//was peeked from. The DFA copies quotes and the bytes it held back (a '/' that did not start a
+//comment) into its own buffer, which splits a stretch of input into several spans; such a byte
+//still continues the run if it is the input byte that comes next
+static void drainBlock(struct Pipes *pp, struct OutBuf *out, const char *in, size_t n){
+  size_t taken = 0;        //bytes of the block already taken out of the input pipe
+  int first = 0;           //first iovec not written yet
+  const char *run = NULL;  //the input the current run of iovecs is a copy of, up to end
+  const char *end = NULL;
+  int from = 0;            //first iovec of the run
+
+  for (int i = 0; i <= out->niov; i++) {
+    const char *p = NULL;
+    size_t len = 0;
+    if (i < out->niov) {
+      p = out->iov[i].iov_base;
+      len = out->iov[i].iov_len;
+      if (run && (p == end || ((size_t)(in + n - end) >= len && !memcmp(p, end, len)))) {
+        end += len;
+        continue;
+      }
+    }
+    if (run && pp->can_splice && end - run >= SPLICE_MIN) {
+      writeSpans(pp, out->iov + first, from - first);
+      dropInput(pp, (run - in) - taken);
+      passInput(pp, run, end - run);
+      taken = end - in;
+      first = i;
+    }
+    run = p && p >= in && p + len <= in + n ? p : NULL;
+    end = run ? p + len : NULL;
+    from = i;
+  }
+  writeSpans(pp, out->iov + first, out->niov - first);
+  dropInput(pp, n - taken);
+  out->niov = 0;
+  out->len = 0;
+}
+
+//decomments the input pipe infd to the output pipe outfd. Returns -1, without having read
+//anything, if they are not both pipes or the kernel cannot tee(2) them
+int decommentSplice(int infd, int outfd, size_t bufsize, struct DFA *dfa)
+{
+  struct Pipes pp = { infd, outfd, { -1, -1 }, -1, 1, NULL, DEFAULT_BUFSIZE, NULL };
+  struct stat si, so;
+
+  if (fstat(infd, &si) < 0 || fstat(outfd, &so) < 0 || !S_ISFIFO(si.st_mode) ||
+      !S_ISFIFO(so.st_mode) || pipe(pp.peek) < 0)
+    return -1;
+  //a block is at most what the pipes hold; ask for bigger pipes if the blocks are bigger
+  fcntl(infd, F_SETPIPE_SZ, (int)bufsize);
+  fcntl(pp.peek[1], F_SETPIPE_SZ, (int)bufsize);
+  int size = fcntl(pp.peek[1], F_GETPIPE_SZ);
+  if (size > 0 && (size_t)size < bufsize) bufsize = size;
+
+  //the whole block's output has to stay in the output block until drainBlock() (a flush in the
+  //middle would write spans that should be spliced): the DFA prints at most two bytes and adds
+  //at most two spans per input byte
+  size_t cap = 2 * bufsize + 2;
+  char *in = malloc(bufsize), *lit = malloc(cap);
+  struct iovec *iov = malloc(cap * sizeof *iov);
+  pp.null = open("/dev/null", O_WRONLY);
+  pp.drop = malloc(pp.dropsize);
+  pp.stage = malloc(cap);
+  if (in == NULL || lit == NULL || iov == NULL || pp.drop == NULL || pp.stage == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  if (pp.null < 0) pp.can_splice = 0;
+  struct OutBuf out = { outfd, lit, 0, cap, iov, 0, (int)cap, NULL, NULL, NULL };
+
+  int status = 0;
+  for (int first = 1; ; first = 0) {
+    ssize_t n = peekInput(&pp, in, bufsize);
+    if (n < 0 && first) { //no tee(2) here, the caller streams instead
+      status = -1;
+      break;
+    }
+    if (n < 0) {
+      perror("tee");
+      exit(EXIT_FAILURE);
+    }
+    if (n == 0) break; //EOF
+
+    decomment(dfa, in, n, &out);
+    drainBlock(&pp, &out, in, n);
+  }
+
+  close(pp.peek[0]);
+  close(pp.peek[1]);
+  if (pp.null >= 0) close(pp.null);
+  free(in);
+  free(lit);
+  free(iov);
+  free(pp.drop);
+  free(pp.stage);
+  return status;
+}
@@ -0,0 +1,18 @@
+// 편예빈, Assignment 1, File name: passthrough.h
+//
+// Pipe passthrough (-i splice): when the input and the output are both pipes, long stretches of
+// code without comments or quotes are moved from one pipe to the other with splice(2) instead of
+// being copied out of the kernel and back in.
+
+#ifndef _PASSTHROUGH_H_
+#define _PASSTHROUGH_H_
+
+#include <stddef.h>
+
+#include "dfa.h"
+
+#define SPLICE_MIN 4096 // shortest copied stretch worth a splice(2) of its own
+
+int decommentSplice(int infd, int outfd, size_t bufsize, struct DFA *dfa);
+
+#endif
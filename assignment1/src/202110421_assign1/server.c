@@ -0,0 +1,401 @@
+// 편예빈, Assignment 1, File name: server.c
+//
+// The decomment server and its client.
+//
+// Protocol (one UNIX stream socket per client, any number of requests on it, one after another):
+//   request:  struct Request. REQ_FD carries the input file descriptor as SCM_RIGHTS ancillary
+//             data; REQ_INLINE is followed by the input as frames (a uint32_t length, then that
+//             many bytes) ending with an empty frame.
+//   response: the output as frames, an empty frame, then struct Reply and Reply.errlen bytes of
+//             diagnostics (what decomment would print on stderr).
+// Numbers are in host byte order: both ends are on the same machine.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "dfa.h"
+#include "server.h"
+
+#define SERVE_MAGIC 0x444d4331    // "1CMD": first word of every request
+#define MAX_ERRLEN 256            // longest diagnostics text in a reply
+
+enum RequestKind {REQ_FD = 1, REQ_INLINE = 2};
+
+struct Request {
+  uint32_t magic;
+  uint32_t kind;
+};
+
+struct Reply {
+  int32_t status;                 // exit code of the equivalent decomment run
+  uint32_t errlen;
+};
+
+// one connected client, served by its own thread
+struct Conn {
+  int sock;
+  int broken;                     // the client went away, output is dropped
+  size_t bufsize;
+  char *in;                       // input block for streamed fds and inline frames
+};
+
+static const char *sock_path;     // unlinked when the server is stopped
+
+//sends all of iov. Returns -1 if the peer is gone
+static int sendAll(int sock, struct iovec *iov, int n){
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+
+  while (n > 0) {
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+    ssize_t w = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    while (n > 0 && (size_t)w >= iov->iov_len) { //drop what went out completely
+      w -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+  return 0;
+}
+
+//reads exactly n bytes. Returns 1, 0 on EOF before the first byte, -1 on error or a short read
+static int readFull(int fd, void *p, size_t n){
+  size_t got = 0;
+  while (got < n) {
+    ssize_t r = read(fd, (char *)p + got, n - got);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (r == 0) return got ? -1 : 0;
+    got += r;
+  }
+  return 1;
+}
+
+//sends one frame of output to the client (decomment_out_fn for the incremental API)
+static void sendFrame(void *arg, const char *data, size_t len){
+  struct Conn *c = arg;
+  uint32_t n = (uint32_t)len;
+  struct iovec iov[2] = { { &n, sizeof n }, { (void *)data, len } };
+
+  if (!c->broken && sendAll(c->sock, iov, 2) < 0) c->broken = 1;
+}
+
+//receives a request header and the fd that comes with it (-1 if none).
+//Returns 1, 0 when the client is done, -1 on a bad request
+static int recvRequest(int sock, struct Request *req, int *fd){
+  char cbuf[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { req, sizeof *req };
+  struct msghdr msg;
+  ssize_t r;
+
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof cbuf;
+  *fd = -1;
+
+  do r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  while (r < 0 && errno == EINTR);
+  if (r <= 0) return r == 0 ? 0 : -1;
+
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+  if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+    memcpy(fd, CMSG_DATA(cm), sizeof(int));
+  //the header is tiny, but a stream socket may still split it
+  if ((size_t)r < sizeof *req && readFull(sock, (char *)req + r, sizeof *req - r) != 1) return -1;
+  if (req->magic != SERVE_MAGIC) {
+    if (*fd >= 0) close(*fd);
+    return -1;
+  }
+  return 1;
+}
+
+//runs the DFA over everything fd holds. Returns 0, or errno if it cannot be read
+static int feedFd(struct Conn *c, struct decomment_ctx *ctx, int fd){
+  struct stat st;
+  if (fstat(fd, &st) < 0) return errno;
+
+  //regular files read from their start are mapped, like decomment does, and their offset is moved
+  //to the end as reading them would; anything else is read from where the client left it
+  if (S_ISREG(st.st_mode) && st.st_size > 0 && lseek(fd, 0, SEEK_CUR) == 0) {
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      decomment_feed(ctx, map, st.st_size, sendFrame, c);
+      munmap(map, st.st_size);
+      lseek(fd, st.st_size, SEEK_SET);
+      return 0;
+    }
+  }
+  while (1) {
+    ssize_t n = read(fd, c->in, c->bufsize);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return errno;
+    }
+    if (n == 0) return 0; //EOF
+    decomment_feed(ctx, c->in, n, sendFrame, c);
+  }
+}
+
+//runs the DFA over inline frames until the empty one. Returns 0, or -1 if the client breaks off
+static int feedInline(struct Conn *c, struct decomment_ctx *ctx){
+  uint32_t len;
+  while (readFull(c->sock, &len, sizeof len) == 1) {
+    if (len == 0) return 0;
+    while (len > 0) { //a frame may be bigger than the input block
+      size_t n = len < c->bufsize ? len : c->bufsize;
+      if (readFull(c->sock, c->in, n) != 1) return -1;
+      decomment_feed(ctx, c->in, n, sendFrame, c);
+      len -= n;
+    }
+  }
+  return -1;
+}
+
+//serves one request. Returns -1 if the connection cannot be used any more
+static int serveRequest(struct Conn *c, const struct Request *req, int fd){
+  struct decomment_ctx ctx;
+  char err[MAX_ERRLEN] = "";
+  struct Reply reply = { EXIT_SUCCESS, 0 };
+  uint32_t end = 0;
+  int line;
+
+  if (decomment_ctx_init(&ctx, c->bufsize) < 0) return -1;
+
+  if (req->kind == REQ_FD && fd >= 0) {
+    int e = feedFd(c, &ctx, fd);
+    if (e != 0) {
+      snprintf(err, sizeof err, "read: %s\n", strerror(e));
+      reply.status = EXIT_FAILURE;
+    }
+  }
+  else if (req->kind == REQ_INLINE) {
+    if (feedInline(c, &ctx) < 0) {
+      decomment_ctx_free(&ctx);
+      return -1;
+    }
+  }
+  else {
+    snprintf(err, sizeof err, "Bad request.\n");
+    reply.status = EXIT_FAILURE;
+  }
+
+  line = decomment_finish(&ctx, sendFrame, c);
+  if (reply.status == EXIT_SUCCESS && line > 0) //same message as decomment, same exit code too
+    snprintf(err, sizeof err, "Error: line %d: unterminated comment\n", line);
+  decomment_ctx_free(&ctx);
+
+  reply.errlen = strlen(err);
+  struct iovec iov[3] = { { &end, sizeof end }, { &reply, sizeof reply }, { err, reply.errlen } };
+  if (c->broken || sendAll(c->sock, iov, 3) < 0) return -1;
+  return 0;
+}
+
+//thread body: serves the requests of one client until it hangs up
+static void *serveClient(void *arg){
+  struct Conn *c = arg;
+  struct Request req;
+  int fd;
+
+  c->in = malloc(c->bufsize);
+  while (c->in && recvRequest(c->sock, &req, &fd) == 1) {
+    int r = serveRequest(c, &req, fd);
+    if (fd >= 0) close(fd);
+    if (r < 0) break;
+  }
+  close(c->sock);
+  free(c->in);
+  free(c);
+  return NULL;
+}
+
+static void stopServer(int sig){
+  (void)sig;
+  unlink(sock_path);
+  _exit(EXIT_SUCCESS);
+}
+
+//--serve: listens on the socket at path and serves every client in its own thread. Only returns
+//if the socket cannot be set up
+int decommentServe(const char *path, size_t bufsize)
+{
+  struct sockaddr_un addr;
+  struct stat st;
+  pthread_attr_t attr;
+
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof addr.sun_path) {
+    fprintf(stderr, "Socket path '%s' is too long.\n", path);
+    return EXIT_FAILURE;
+  }
+  strcpy(addr.sun_path, path);
+
+  int lsock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (lsock < 0) {
+    perror("socket");
+    return EXIT_FAILURE;
+  }
+  if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path); //left over from an earlier server
+  if (bind(lsock, (struct sockaddr *)&addr, sizeof addr) < 0 || listen(lsock, SOMAXCONN) < 0) {
+    perror(path);
+    return EXIT_FAILURE;
+  }
+
+  sock_path = path;
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, stopServer);
+  signal(SIGTERM, stopServer);
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  while (1) {
+    int sock = accept(lsock, NULL, NULL);
+    if (sock < 0) {
+      if (errno != EINTR && errno != ECONNABORTED) perror("accept");
+      continue;
+    }
+    struct Conn *c = calloc(1, sizeof *c);
+    pthread_t tid;
+    if (c == NULL) {
+      close(sock);
+      continue;
+    }
+    c->sock = sock;
+    c->bufsize = bufsize;
+    if (pthread_create(&tid, &attr, serveClient, c) != 0) {
+      close(sock);
+      free(c);
+    }
+  }
+}
+
+// input of an inline request, sent by its own thread while the caller reads the response
+struct Sender {
+  int sock, fd;
+  size_t bufsize;
+};
+
+//sends everything fd holds as inline frames, then the empty frame
+static void *sendInline(void *arg){
+  struct Sender *s = arg;
+  char *in = malloc(s->bufsize);
+  uint32_t n = 0;
+
+  while (in) {
+    ssize_t r = read(s->fd, in, s->bufsize);
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0) perror("read");
+    if (r <= 0) break;
+    n = (uint32_t)r;
+    struct iovec iov[2] = { { &n, sizeof n }, { in, n } };
+    if (sendAll(s->sock, iov, 2) < 0) break;
+  }
+  n = 0;
+  struct iovec end = { &n, sizeof n };
+  sendAll(s->sock, &end, 1);
+  free(in);
+  return NULL;
+}
+
+//client mode: has the server at path decomment infd, writes the output to stdout and the
+//diagnostics to stderr. Returns the exit code, or -1 if there is no server to connect to
+int decommentClient(const char *path, int infd, size_t bufsize)
+{
+  struct sockaddr_un addr;
+  struct Request req = { SERVE_MAGIC, REQ_FD };
+  struct Reply reply;
+  struct Sender sender = { -1, infd, bufsize };
+  struct stat st;
+  pthread_t tid;
+  int inline_input = fstat(infd, &st) < 0 || !S_ISREG(st.st_mode);
+
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof addr.sun_path) return -1;
+  strcpy(addr.sun_path, path);
+
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0) return -1;
+  if (connect(sock, (struct sockaddr *)&addr, sizeof addr) < 0) {
+    close(sock);
+    return -1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  //regular files are passed as they are; pipes and terminals are read here and sent inline
+  char cbuf[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = { &req, sizeof req };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof msg);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (inline_input) req.kind = REQ_INLINE;
+  else {
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof cbuf;
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &infd, sizeof(int));
+  }
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof req) {
+    close(sock);
+    return -1;
+  }
+  sender.sock = sock;
+  if (inline_input && pthread_create(&tid, NULL, sendInline, &sender) != 0) {
+    perror("pthread_create");
+    exit(EXIT_FAILURE);
+  }
+
+  //output frames until the empty one, then the reply
+  char *buf = malloc(bufsize);
+  uint32_t len;
+  int ok = buf != NULL;
+  while (ok && (ok = readFull(sock, &len, sizeof len) == 1) && len > 0) {
+    while (ok && len > 0) {
+      size_t n = len < bufsize ? len : bufsize;
+      ok = readFull(sock, buf, n) == 1;
+      if (ok) writeAll(STDOUT_FILENO, buf, n);
+      len -= n;
+    }
+  }
+  char err[MAX_ERRLEN];
+  ok = ok && readFull(sock, &reply, sizeof reply) == 1 && reply.errlen <= sizeof err &&
+       (reply.errlen == 0 || readFull(sock, err, reply.errlen) == 1);
+  if (ok) writeAll(STDERR_FILENO, err, reply.errlen);
+  else fprintf(stderr, "Lost the connection to the decomment server at '%s'.\n", path);
+
+  if (inline_input) {
+    shutdown(sock, SHUT_RDWR); //wakes the sender up if the server is gone
+    pthread_join(tid, NULL);
+  }
+  close(sock);
+  free(buf);
+  return ok ? reply.status : EXIT_FAILURE;
+}
@@ -0,0 +1,17 @@
+// 편예빈, Assignment 1, File name: server.h
+//
+// decomment --serve: a long-lived decomment process that takes requests over a UNIX domain socket,
+// so that decommenting many small files does not pay for a process start-up each time, and the
+// client side that sends a plain decomment invocation's input to it.
+
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stddef.h>
+
+#define SOCKET_ENV "DECOMMENT_SOCKET" // if set, decomment tries the server at this path first
+
+int decommentServe(const char *path, size_t bufsize);
+int decommentClient(const char *path, int infd, size_t bufsize);
+
+#endif
@@ -0,0 +1,64 @@
+// 편예빈, Assignment 1, File name: stats.c
+//
+// Profiling counters (--stats): the phase clock and the JSON report. See stats.h.
+
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+#ifdef DECOMMENT_STATS
+
+struct DFAStats dfa_stats;
+
+static const char *const state_names[NSTATE] = {
+  "START", "QUOTE", "CHAR", "WAIT_COMMENT", "SINGLELINE", "MULTILINE", "WAIT_END"
+};
+static const char *const phase_names[NPHASE] = { "setup", "read", "decomment", "write", "finish" };
+
+static double seconds(clockid_t clock){
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//charges the time since the last switch to the current phase and makes ph the current one.
+//Returns the phase that was current
+enum StatPhase statsPhase(enum StatPhase ph){
+  static enum StatPhase current = PH_SETUP;
+  static double wall, cpu;
+  double w = seconds(CLOCK_MONOTONIC), c = seconds(CLOCK_PROCESS_CPUTIME_ID);
+  enum StatPhase prev = current;
+
+  if (wall > 0) {
+    dfa_stats.wall[current] += w - wall;
+    dfa_stats.cpu[current] += c - cpu;
+  }
+  wall = w;
+  cpu = c;
+  current = ph;
+  return prev;
+}
+
+//prints the counters as one JSON object. dfa is the DFA at the end of the input: the run of the
+//state it ended in is not over yet, and an open comment is unterminated
+void statsPrint(FILE *f, const struct DFA *dfa){
+  struct DFAStats *s = &dfa_stats;
+  if ((unsigned long long)(dfa->in_off - s->run_start) > s->longest[dfa->state])
+    s->longest[dfa->state] = dfa->in_off - s->run_start;
+
+  fprintf(f, "{\"bytes\": %lld, \"states\": {", dfa->in_off);
+  for (int i = 0; i < NSTATE; i++)
+    fprintf(f, "%s\"%s\": {\"bytes\": %llu, \"enter\": %llu, \"leave\": %llu, \"longest_run\": %llu}",
+            i ? ", " : "", state_names[i], s->bytes[i], s->enter[i], s->leave[i], s->longest[i]);
+  fprintf(f, "}, \"comments\": {\"line\": %llu, \"block\": %llu, \"unterminated\": %d, "
+             "\"not_comment\": %llu}, \"phases\": {",
+          s->line_comments, s->block_comments, dfa->state == MULTILINE || dfa->state == WAIT_END,
+          s->not_comments);
+  for (int i = 0; i < NPHASE; i++)
+    fprintf(f, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}", i ? ", " : "", phase_names[i],
+            s->wall[i], s->cpu[i]);
+  fprintf(f, "}}\n");
+}
+
+#endif
@@ -0,0 +1,69 @@
+// 편예빈, Assignment 1, File name: stats.h
+//
+// Profiling counters (--stats). Built only with -DDECOMMENT_STATS (make STATS=1): in the default
+// build the STAT_* macros below are empty, so the DFA cores do not pay for them.
+//
+// For every DFA state: the bytes consumed in it, the transitions into and out of it and the
+// longest run of bytes spent in it in one go. Also the comments by type, and the wall and CPU time
+// of each phase of the run. The counters are global, so only one DFA may run at a time.
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+
+#include "dfa.h"
+
+#define NSTATE (WAIT_END + 1)
+
+enum StatPhase {PH_SETUP, PH_READ, PH_DECOMMENT, PH_WRITE, PH_FINISH, NPHASE};
+
+struct DFAStats {
+  unsigned long long bytes[NSTATE], enter[NSTATE], leave[NSTATE], longest[NSTATE];
+  unsigned long long line_comments, block_comments, not_comments; // '/' not starting a comment
+  long long run_start;            // input offset where the current state was entered
+  double wall[NPHASE], cpu[NPHASE];
+};
+
+extern struct DFAStats dfa_stats;
+
+enum StatPhase statsPhase(enum StatPhase ph);
+void statsPrint(FILE *f, const struct DFA *dfa);
+
+#ifdef DECOMMENT_STATS
+
+//counts the byte at input offset off, on which the DFA went from state from to dfa->state
+static inline void statsStep(const struct DFA *dfa, enum DFAState from, long long off){
+  struct DFAStats *s = &dfa_stats;
+  s->bytes[from]++;
+  if (dfa->state == from) return;
+  s->leave[from]++;
+  s->enter[dfa->state]++;
+  if ((unsigned long long)(off + 1 - s->run_start) > s->longest[from])
+    s->longest[from] = off + 1 - s->run_start;
+  s->run_start = off + 1;
+  if (from == WAIT_COMMENT) {
+    if (dfa->state == SINGLELINE) s->line_comments++;
+    else if (dfa->state == MULTILINE) s->block_comments++;
+    else s->not_comments++;
+  }
+}
+
+#define STAT_RUN(state, n) (dfa_stats.bytes[state] += (n))
+#define STAT_STEP(dfa, from, off) statsStep(dfa, from, off)
+//time between STAT_BEGIN and STAT_END counts for phase ph, then for the phase before it again
+#define STAT_BEGIN(ph) enum StatPhase stat_prev_ = statsPhase(ph)
+#define STAT_END() statsPhase(stat_prev_)
+#define STAT_PHASE(ph) statsPhase(ph)
+
+#else
+
+#define STAT_RUN(state, n) ((void)0)
+#define STAT_STEP(dfa, from, off) ((void)0)
+#define STAT_BEGIN(ph) ((void)0)
+#define STAT_END() ((void)0)
+#define STAT_PHASE(ph) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,509 @@
+// 편예빈, Assignment 1, File name: tree.c
+//
+// Tree mode. The source tree is walked once, directory by directory, with openat(2) and
+// getdents64(2); the directories are created under dst as they are found and the regular files are
+// listed (symbolic links and other special files are left out). Files whose size and modification
+// time are the ones recorded in dst/TREE_STATE by the last run, and whose output is still there,
+// are not decommented again. src must not be dst or inside it, and a file that is its own output
+// (a hard link into dst) is skipped: the output is truncated while the input is still mapped.
+//
+// The rest is sorted by size, largest first, and dealt round-robin onto one queue per worker. A
+// worker takes the largest file left on its own queue; when that is empty, it steals the smallest
+// one left on another worker's queue, so the big files still go first and the owner and the thief
+// work at different ends. Files are mapped and decommented in span mode, as in the single-file
+// mmap path.
+//
+// At the end the unterminated comments and the errors of this run (and the unterminated comments
+// of the skipped files, from the state file) go to one log, sorted by path, followed by the totals,
+// which are also printed on stderr. Then the state file is rewritten.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include "dfa.h"
+#include "tree.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#define MAX_PATH_LEN 4096
+#define MAX_THREADS 256
+#define DIRENT_BUF (1 << 15)      // bytes asked from getdents64(2) at a time
+
+// one record of getdents64(2)
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// a regular file of the source tree
+struct TreeFile {
+  char *rel;                      // path relative to src (and to dst)
+  off_t size;
+  struct timespec mtime;
+  int line;                       // line of an unterminated comment, 0 if there is none
+  int skipped;                    // unchanged since the last run
+  char *error;                    // why it failed, NULL if it did not
+};
+
+// what the last run recorded for one file
+struct Recorded {
+  char *rel;
+  long long size, sec, nsec;
+  int line;
+};
+
+// a worker's queue: indices into Tree.files, largest file first
+struct Queue {
+  pthread_mutex_t lock;
+  int *files;
+  int head, tail;
+};
+
+struct Tree {
+  const char *src, *dst;
+  int srcfd, dstfd;
+  dev_t dst_dev;                  // dst itself is not walked if it is inside src
+  ino_t dst_ino;
+  struct TreeFile *files;
+  int nfiles, cap;
+  struct Recorded *last;          // the last run's state file, sorted by path
+  int nlast;
+  char **errors;                  // errors of the walk, as log lines
+  int nerrors;
+  struct Queue *queues;
+  int nqueues;
+  unsigned long long bytes;       // totals (atomic)
+  int done, failed;
+};
+
+static int byRel(const void *a, const void *b){
+  return strcmp(((const struct Recorded *)a)->rel, ((const struct Recorded *)b)->rel);
+}
+
+static int byFileRel(const void *a, const void *b){
+  return strcmp(((const struct TreeFile *)a)->rel, ((const struct TreeFile *)b)->rel);
+}
+
+// a file to be decommented, while the queues are dealt
+struct Job {
+  off_t size;
+  int file;
+};
+
+//largest first
+static int bySize(const void *a, const void *b){
+  off_t x = ((const struct Job *)a)->size, y = ((const struct Job *)b)->size;
+  return (x < y) - (x > y);
+}
+
+static void *xrealloc(void *p, size_t size){
+  p = realloc(p, size);
+  if (p == NULL) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static char *xstrdup(const char *s){
+  char *p = strdup(s);
+  if (p == NULL) {
+    perror("strdup");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+//records an error of the walk: "<rel>: <strerror(err)>"
+static void walkError(struct Tree *t, const char *rel, int err){
+  char line[MAX_PATH_LEN + 128];
+  snprintf(line, sizeof line, "%s: %s", *rel ? rel : ".", strerror(err));
+  t->errors = xrealloc(t->errors, (t->nerrors + 1) * sizeof *t->errors);
+  t->errors[t->nerrors++] = xstrdup(line);
+}
+
+//--------------------------------------------------------------------------------------------------
+// State of the last run
+
+//reads dst/TREE_STATE: one line per file, "<size> <sec> <nsec> <line> <path>"
+static void readState(struct Tree *t){
+  int fd = openat(t->dstfd, TREE_STATE, O_RDONLY);
+  FILE *fp = fd >= 0 ? fdopen(fd, "r") : NULL;
+  char *buf = NULL;
+  size_t size = 0;
+  ssize_t len;
+  int cap = 0;
+
+  if (fp == NULL) return;
+  while ((len = getline(&buf, &size, fp)) > 0) {
+    struct Recorded r;
+    int off;
+    if (buf[len - 1] == '\n') buf[--len] = '\0';
+    if (sscanf(buf, "%lld %lld %lld %d %n", &r.size, &r.sec, &r.nsec, &r.line, &off) != 4 || !buf[off])
+      continue;
+    r.rel = xstrdup(buf + off);
+    if (t->nlast == cap) {
+      cap = cap ? cap * 2 : 256;
+      t->last = xrealloc(t->last, cap * sizeof *t->last);
+    }
+    t->last[t->nlast++] = r;
+  }
+  free(buf);
+  fclose(fp);
+  qsort(t->last, t->nlast, sizeof *t->last, byRel);
+}
+
+//writes the state of every file that is now up to date in dst. Names with a newline are left out
+//(they are decommented every time)
+static void writeState(struct Tree *t){
+  char tmp[64];
+  snprintf(tmp, sizeof tmp, "%s.%d", TREE_STATE, (int)getpid());
+  int fd = openat(t->dstfd, tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  FILE *fp = fd >= 0 ? fdopen(fd, "w") : NULL;
+
+  if (fp == NULL) {
+    perror(TREE_STATE);
+    return;
+  }
+  for (int i = 0; i < t->nfiles; i++) {
+    struct TreeFile *f = &t->files[i];
+    if (f->error || strchr(f->rel, '\n')) continue;
+    fprintf(fp, "%lld %lld %ld %d %s\n", (long long)f->size, (long long)f->mtime.tv_sec,
+            f->mtime.tv_nsec, f->line, f->rel);
+  }
+  if (fclose(fp) != 0 || renameat(t->dstfd, tmp, t->dstfd, TREE_STATE) < 0) {
+    perror(TREE_STATE);
+    unlinkat(t->dstfd, tmp, 0);
+  }
+}
+
+//returns 1 if f is as the last run left it and its output is still there; takes over its line
+static int unchanged(struct Tree *t, struct TreeFile *f){
+  struct Recorded key = { f->rel, 0, 0, 0, 0 };
+  struct Recorded *r = bsearch(&key, t->last, t->nlast, sizeof *t->last, byRel);
+  struct stat st;
+
+  if (r == NULL || r->size != (long long)f->size || r->sec != (long long)f->mtime.tv_sec ||
+      r->nsec != f->mtime.tv_nsec || fstatat(t->dstfd, f->rel, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+      !S_ISREG(st.st_mode))
+    return 0;
+  f->line = r->line;
+  return 1;
+}
+
+//--------------------------------------------------------------------------------------------------
+// Walk
+
+//walks the directory dirfd, which is rel (of length len) in the source tree
+static void walk(struct Tree *t, int dirfd, char *rel, size_t len){
+  char *buf = malloc(DIRENT_BUF);
+  long n;
+
+  if (buf == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  while ((n = syscall(SYS_getdents64, dirfd, buf, DIRENT_BUF)) > 0) {
+    for (long off = 0; off < n; ) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+      const char *name = d->d_name;
+      struct stat st;
+      off += d->d_reclen;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) continue;
+      if (d->d_type != DT_DIR && d->d_type != DT_REG && d->d_type != DT_UNKNOWN) continue;
+
+      size_t nlen = strlen(name);
+      if (len + nlen + 2 > MAX_PATH_LEN) {
+        rel[len] = '\0';
+        walkError(t, rel, ENAMETOOLONG);
+        continue;
+      }
+      size_t sub = len;
+      if (len) rel[sub++] = '/';
+      memcpy(rel + sub, name, nlen + 1);
+      sub += nlen;
+
+      if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) walkError(t, rel, errno);
+      else if (S_ISDIR(st.st_mode)) {
+        if (st.st_dev == t->dst_dev && st.st_ino == t->dst_ino) continue; //dst is inside src
+        if (mkdirat(t->dstfd, rel, 0777) < 0 && errno != EEXIST) {
+          walkError(t, rel, errno);
+          continue;
+        }
+        int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+        if (fd < 0) walkError(t, rel, errno);
+        else {
+          walk(t, fd, rel, sub);
+          close(fd);
+        }
+      }
+      else if (S_ISREG(st.st_mode)) {
+        if (t->nfiles == t->cap) {
+          t->cap = t->cap ? t->cap * 2 : 1024;
+          t->files = xrealloc(t->files, t->cap * sizeof *t->files);
+        }
+        struct TreeFile *f = &t->files[t->nfiles++];
+        f->rel = xstrdup(rel);
+        f->size = st.st_size;
+        f->mtime = st.st_mtim;
+        f->line = 0;
+        f->error = NULL;
+        f->skipped = unchanged(t, f);
+      }
+    }
+  }
+  rel[len] = '\0';
+  if (n < 0) walkError(t, rel, errno);
+  free(buf);
+}
+
+//--------------------------------------------------------------------------------------------------
+// Workers
+
+//decomments one file. On error, f->error says why
+static void treeFile(struct Tree *t, struct TreeFile *f){
+  char bytes[DEFAULT_BUFSIZE];
+  struct iovec iov[IOV_MAX];
+  struct DFA dfa = DFA_INIT;
+  struct stat st;
+  char *in = NULL;
+  size_t n = 0;
+
+  int infd = openat(t->srcfd, f->rel, O_RDONLY | O_NOFOLLOW);
+  if (infd < 0 || fstat(infd, &st) < 0) goto fail;
+  n = st.st_size;
+  f->size = st.st_size;
+  f->mtime = st.st_mtim;
+  if (n > 0) {
+    in = mmap(NULL, n, PROT_READ, MAP_PRIVATE, infd, 0);
+    if (in == MAP_FAILED) goto fail;
+  }
+  //truncating the output would destroy the input if they are the same file (a hard link, say)
+  struct stat ost;
+  if (fstatat(t->dstfd, f->rel, &ost, 0) == 0 && ost.st_dev == st.st_dev && ost.st_ino == st.st_ino) {
+    f->error = xstrdup("source and output are the same file, skipped");
+    if (in) munmap(in, n);
+    close(infd);
+    __atomic_fetch_add(&t->failed, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  int outfd = openat(t->dstfd, f->rel, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (outfd < 0) goto fail;
+
+  struct OutBuf out = { outfd, bytes, 0, sizeof bytes, iov, 0, IOV_MAX, NULL, NULL, NULL };
+  decomment(&dfa, in, n, &out);
+  outFlush(&out);
+  if (close(outfd) < 0) goto fail;
+  if (dfa.state == MULTILINE || dfa.state == WAIT_END) f->line = dfa.line_com;
+  if (in) munmap(in, n);
+  close(infd);
+  __atomic_fetch_add(&t->bytes, (unsigned long long)n, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&t->done, 1, __ATOMIC_RELAXED);
+  return;
+
+fail:
+  f->error = xstrdup(strerror(errno));
+  if (in && in != MAP_FAILED) munmap(in, n);
+  if (infd >= 0) close(infd);
+  __atomic_fetch_add(&t->failed, 1, __ATOMIC_RELAXED);
+}
+
+//returns 1 if src is dst or is inside it: walks up from src through ".." to the root
+static int insideDst(struct Tree *t){
+  int fd = dup(t->srcfd);
+  struct stat st, up;
+
+  while (fd >= 0 && fstat(fd, &st) == 0) {
+    if (st.st_dev == t->dst_dev && st.st_ino == t->dst_ino) {
+      close(fd);
+      return 1;
+    }
+    int parent = openat(fd, "..", O_RDONLY | O_DIRECTORY);
+    close(fd);
+    if (parent < 0 || fstat(parent, &up) < 0 || (up.st_dev == st.st_dev && up.st_ino == st.st_ino)) {
+      if (parent >= 0) close(parent);
+      return 0;                                     //the root
+    }
+    fd = parent;
+  }
+  if (fd >= 0) close(fd);
+  return 0;
+}
+
+//takes the next file for worker w: the largest on its own queue, or the smallest on another one.
+//Returns -1 when every queue is empty
+static int nextFile(struct Tree *t, int w){
+  for (int k = 0; k < t->nqueues; k++) {
+    struct Queue *q = &t->queues[(w + k) % t->nqueues];
+    int i = -1;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) i = k == 0 ? q->files[q->head++] : q->files[--q->tail];
+    pthread_mutex_unlock(&q->lock);
+    if (i >= 0) return i;
+  }
+  return -1;
+}
+
+struct Worker {
+  struct Tree *t;
+  int w;
+};
+
+static void *treeWorker(void *arg){
+  struct Worker *wk = arg;
+  int i;
+  while ((i = nextFile(wk->t, wk->w)) >= 0) treeFile(wk->t, &wk->t->files[i]);
+  return NULL;
+}
+
+//--------------------------------------------------------------------------------------------------
+
+//writes the log: walk errors, then per file (sorted by path) errors and unterminated comments,
+//then the totals line
+static void writeLog(struct Tree *t, const char *log, const char *totals){
+  char path[MAX_PATH_LEN];
+  FILE *fp;
+
+  if (log == NULL) {
+    snprintf(path, sizeof path, "%s/%s", t->dst, TREE_LOG);
+    log = path;
+  }
+  if ((fp = fopen(log, "w")) == NULL) {
+    perror(log);
+    return;
+  }
+  for (int i = 0; i < t->nerrors; i++) fprintf(fp, "%s\n", t->errors[i]);
+  for (int i = 0; i < t->nfiles; i++) {
+    struct TreeFile *f = &t->files[i];
+    if (f->error) fprintf(fp, "%s: %s\n", f->rel, f->error);
+    else if (f->line) fprintf(fp, "%s: Error: line %d: unterminated comment\n", f->rel, f->line);
+  }
+  fprintf(fp, "%s\n", totals);
+  fclose(fp);
+}
+
+//tree mode: decomments every regular file under src into dst with nthreads workers, writes the
+//log and prints the totals on stderr
+int decommentTree(const char *src, const char *dst, const char *log, int nthreads)
+{
+  struct Tree t;
+  char rel[MAX_PATH_LEN] = "", totals[256];
+  pthread_t tid[MAX_THREADS];
+  struct Worker workers[MAX_THREADS];
+  struct timespec t0, t1;
+  struct stat st;
+
+  memset(&t, 0, sizeof t);
+  t.src = src;
+  t.dst = dst;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if ((mkdir(dst, 0777) < 0 && errno != EEXIST) ||
+      (t.dstfd = open(dst, O_RDONLY | O_DIRECTORY)) < 0 || fstat(t.dstfd, &st) < 0) {
+    perror(dst);
+    return EXIT_FAILURE;
+  }
+  t.dst_dev = st.st_dev;
+  t.dst_ino = st.st_ino;
+  if ((t.srcfd = open(src, O_RDONLY | O_DIRECTORY)) < 0) {
+    perror(src);
+    return EXIT_FAILURE;
+  }
+  if (insideDst(&t)) {
+    fprintf(stderr, "%s: the source tree is %s %s.\n", src,
+            (fstat(t.srcfd, &st) == 0 && st.st_dev == t.dst_dev && st.st_ino == t.dst_ino) ?
+            "the same directory as" : "inside", dst);
+    return EXIT_FAILURE;
+  }
+
+  readState(&t);
+  walk(&t, t.srcfd, rel, 0);
+
+  //deal the files to be decommented onto the queues, largest first
+  struct Job *order = malloc((t.nfiles + 1) * sizeof *order);
+  int nwork = 0, skipped = 0;
+  t.nqueues = nthreads;
+  t.queues = calloc(nthreads, sizeof *t.queues);
+  if (order == NULL || t.queues == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < t.nfiles; i++) {
+    if (t.files[i].skipped) skipped++;
+    else order[nwork++] = (struct Job){ t.files[i].size, i };
+  }
+  qsort(order, nwork, sizeof *order, bySize);
+  for (int w = 0; w < nthreads; w++) {
+    pthread_mutex_init(&t.queues[w].lock, NULL);
+    t.queues[w].files = malloc((nwork / nthreads + 1) * sizeof(int));
+    if (t.queues[w].files == NULL) {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int k = 0; k < nwork; k++) {
+    struct Queue *q = &t.queues[k % nthreads];
+    q->files[q->tail++] = order[k].file;
+  }
+
+  for (int w = 0; w < nthreads; w++) {
+    workers[w].t = &t;
+    workers[w].w = w;
+    int err = pthread_create(&tid[w], NULL, treeWorker, &workers[w]);
+    if (err) {
+      fprintf(stderr, "pthread_create: %s\n", strerror(err));
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (int w = 0; w < nthreads; w++) pthread_join(tid[w], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  qsort(t.files, t.nfiles, sizeof *t.files, byFileRel);
+  int unterminated = 0;
+  for (int i = 0; i < t.nfiles; i++) unterminated += !t.files[i].error && t.files[i].line;
+  int failed = t.failed + t.nerrors;
+  double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  snprintf(totals, sizeof totals, "%d file%s decommented, %d unchanged, %llu bytes in %.3f s "
+           "(%.1f MB/s), %d unterminated comment%s, %d failed",
+           t.done, t.done == 1 ? "" : "s", skipped, t.bytes, secs,
+           secs > 0 ? t.bytes / secs / 1e6 : 0.0, unterminated, unterminated == 1 ? "" : "s", failed);
+  writeLog(&t, log, totals);
+  writeState(&t);
+  fprintf(stderr, "%s\n", totals);
+
+  for (int i = 0; i < t.nfiles; i++) {
+    free(t.files[i].rel);
+    free(t.files[i].error);
+  }
+  for (int i = 0; i < t.nlast; i++) free(t.last[i].rel);
+  for (int i = 0; i < t.nerrors; i++) free(t.errors[i]);
+  for (int w = 0; w < nthreads; w++) {
+    pthread_mutex_destroy(&t.queues[w].lock);
+    free(t.queues[w].files);
+  }
+  free(t.files);
+  free(t.last);
+  free(t.errors);
+  free(t.queues);
+  free(order);
+  close(t.srcfd);
+  close(t.dstfd);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
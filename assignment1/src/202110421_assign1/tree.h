@@ -0,0 +1,15 @@
+// 편예빈, Assignment 1, File name: tree.h
+//
+// Tree mode (-r src dst): every regular file under src is decommented into the same relative path
+// under dst, by a pool of worker threads. Files that have not changed since the last run into dst
+// are skipped.
+
+#ifndef _TREE_H_
+#define _TREE_H_
+
+#define TREE_STATE ".decomment-state" // in dst: size and mtime of every input of the last run
+#define TREE_LOG ".decomment.log"     // in dst (unless --log): errors and unterminated comments
+
+int decommentTree(const char *src, const char *dst, const char *log, int nthreads);
+
+#endif
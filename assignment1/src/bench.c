@@ -0,0 +1,251 @@
+// bench.c
+//
+// Runs every decomment mode and the reference binary on each corpus file (see gencorpus.c) and
+// reports throughput in MB/s and cycles per input byte. The output and error stream of every mode
+// are compared with those of the serial scalar mode, which all fast paths must reproduce byte for
+// byte, and with those of the reference binary.
+//
+// Usage: bench [-d decomment] [-r reference] [-j threads] [-n repeat] corpus...
+//
+// Each mode runs repeat times (default 3) and the fastest run counts. A mode that fails on empty
+// input (e.g. -s avx2 without AVX2) is reported as skipped. Outputs and the cache of the cache mode
+// go to a fresh directory /tmp/bench.XXXXXX, which is removed at the end. Cycles are TSC cycles on x86
+// (they tick at a constant rate, not the core clock) and are not reported on other machines.
+// Exits with EXIT_FAILURE if any mode's output differs from the serial scalar mode (for the -q
+// modes, only standard output is compared).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define MAX_ARGS 8
+
+// a way to run decomment: a name and the options that select it
+struct Mode {
+  const char *name;
+  const char *args[MAX_ARGS];
+  int quiet;                      // -q: stderr is not compared
+};
+
+// the result of one mode on one corpus
+struct Result {
+  int ok;               // ran and exited normally
+  double secs;          // fastest wall time
+  unsigned long long cycles;
+};
+
+static char dir[] = "/tmp/bench.XXXXXX";
+static char out_file[32], err_file[32], empty_file[32], cache_dir[32];
+static char base_out[64], base_err[64], ref_out[64], ref_err[64];
+
+static double now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long cycles(void){
+#ifdef HAVE_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+//runs argv with stdin from corpus and stdout/stderr to out_file/err_file. Returns the exit code,
+//or -1 if it could not run or was killed
+static int runOnce(char *const argv[], const char *corpus, double *secs, unsigned long long *cyc){
+  double t0 = now();
+  unsigned long long c0 = cycles();
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    int in = open(corpus, O_RDONLY);
+    int out = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int err = open(err_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (in < 0 || out < 0 || err < 0) _exit(127);
+    dup2(in, 0); dup2(out, 1); dup2(err, 2);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0) return -1;
+
+  *cyc = cycles() - c0;
+  *secs = now() - t0;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) return -1;
+  return WEXITSTATUS(status);
+}
+
+//returns 1 if the two files have the same contents
+static int sameFile(const char *a, const char *b){
+  FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+  int same = fa && fb;
+  char ba[1 << 15], bb[1 << 15];
+
+  while (same) {
+    size_t na = fread(ba, 1, sizeof ba, fa), nb = fread(bb, 1, sizeof bb, fb);
+    same = na == nb && !memcmp(ba, bb, na);
+    if (na == 0) break;
+  }
+  if (fa) fclose(fa);
+  if (fb) fclose(fb);
+  return same;
+}
+
+//puts bin and the options of mode m into argv
+static void modeArgs(char *argv[], const char *bin, const struct Mode *m){
+  int n = 0;
+  argv[n++] = (char *)bin;
+  for (int i = 0; m->args[i]; i++) argv[n++] = (char *)m->args[i];
+  argv[n] = NULL;
+}
+
+//returns 1 if the mode runs here: it must succeed on empty input. Any exit code counts on a
+//corpus, as decomment fails on an unterminated comment
+static int usable(const char *bin, const struct Mode *m){
+  char *argv[MAX_ARGS + 2];
+  double secs;
+  unsigned long long cyc;
+  modeArgs(argv, bin, m);
+  return runOnce(argv, empty_file, &secs, &cyc) == 0;
+}
+
+//runs a mode repeat times and keeps the fastest run
+static struct Result runMode(const char *bin, const struct Mode *m, const char *corpus, int repeat){
+  char *argv[MAX_ARGS + 2];
+  struct Result r = { 1, 1e30, 0 };
+
+  modeArgs(argv, bin, m);
+
+  for (int k = 0; k < repeat && r.ok; k++) {
+    double secs;
+    unsigned long long cyc;
+    if (runOnce(argv, corpus, &secs, &cyc) < 0) r.ok = 0;
+    else if (secs < r.secs) {
+      r.secs = secs;
+      r.cycles = cyc;
+    }
+  }
+  return r;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *decomment = "bin/decomment", *reference = "reference/sampledecomment";
+  const char *threads = "4";
+  int repeat = 3, failed = 0, i;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (i + 1 >= argc) break;
+    if (!strcmp(argv[i], "-d")) decomment = argv[++i];
+    else if (!strcmp(argv[i], "-r")) reference = argv[++i];
+    else if (!strcmp(argv[i], "-j")) threads = argv[++i];
+    else if (!strcmp(argv[i], "-n")) repeat = atoi(argv[++i]);
+    else break;
+  }
+  if (i == argc || repeat < 1) {
+    fprintf(stderr, "Usage: %s [-d decomment] [-r reference] [-j threads] [-n repeat] corpus...\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const struct Mode modes[] = { //the first one is the baseline the others are compared with
+    { "serial-scalar", { "-i", "stream", "-s", "scalar", NULL }, 0 },
+    { "serial-sse2",   { "-i", "stream", "-s", "sse2", NULL }, 0 },
+    { "serial-avx2",   { "-i", "stream", "-s", "avx2", NULL }, 0 },
+    { "table",         { "-i", "stream", "-m", "table", NULL }, 0 },
+    { "mmap",          { "-i", "mmap", NULL }, 0 },
+    { "uring",         { "-i", "uring", NULL }, 0 },
+    { "threads",       { "-i", "threads", NULL }, 0 },
+    { "parallel",      { "-j", threads, NULL }, 0 },
+    //the builds of the switch core: no line numbers, line numbers (all of the above), comment stream
+    { "nolines",       { "-i", "stream", "-q", NULL }, 1 },
+    { "mmap-nolines",  { "-i", "mmap", "-q", NULL }, 1 },
+    { "comments",      { "-i", "stream", "--comments", "/dev/null", NULL }, 0 },
+    //the first run fills the cache, the fastest one (with -n 2 or more) is a hit
+    { "cache",         { "--cache", cache_dir, NULL }, 0 },
+  };
+  const struct Mode ref = { "reference", { NULL }, 0 };
+  int nmodes = sizeof modes / sizeof modes[0];
+  int runs[sizeof modes / sizeof modes[0]];
+
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+  snprintf(out_file, sizeof out_file, "%s/out", dir);
+  snprintf(err_file, sizeof err_file, "%s/err", dir);
+  snprintf(base_out, sizeof base_out, "%s.base", out_file);
+  snprintf(base_err, sizeof base_err, "%s.base", err_file);
+  snprintf(ref_out, sizeof ref_out, "%s.ref", out_file);
+  snprintf(ref_err, sizeof ref_err, "%s.ref", err_file);
+  snprintf(empty_file, sizeof empty_file, "%s/empty", dir);
+  snprintf(cache_dir, sizeof cache_dir, "%s/cache", dir);
+  int fd = open(empty_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    perror(empty_file);
+    return EXIT_FAILURE;
+  }
+  close(fd);
+
+  int have_ref = usable(reference, &ref);
+  for (int m = 0; m < nmodes; m++) runs[m] = usable(decomment, &modes[m]);
+
+  printf("%-28s %12s  %-14s %10s %9s  %s\n", "corpus", "bytes", "mode", "MB/s", "cycles/B", "output");
+  for (; i < argc; i++) {
+    struct stat st;
+    if (stat(argv[i], &st) < 0 || st.st_size == 0) {
+      fprintf(stderr, "%s: no such corpus or empty\n", argv[i]);
+      continue;
+    }
+    double mb = st.st_size / 1e6;
+
+    struct Result r = { 0, 0, 0 };
+    if (have_ref) r = runMode(reference, &ref, argv[i], repeat);
+    if (r.ok) {
+      rename(out_file, ref_out);
+      rename(err_file, ref_err);
+      printf("%-28s %12lld  %-14s %10.1f %9.2f  -\n", argv[i], (long long)st.st_size, ref.name,
+             mb / r.secs, (double)r.cycles / st.st_size);
+    }
+    int ref_ok = r.ok;
+
+    for (int m = 0; m < nmodes; m++) {
+      r.ok = 0;
+      if (runs[m]) r = runMode(decomment, &modes[m], argv[i], repeat);
+      printf("%-28s %12s  %-14s ", ref_ok ? "" : argv[i], "", modes[m].name);
+      if (!r.ok) {
+        printf("%10s %9s  skipped (not supported here)\n", "-", "-");
+        continue;
+      }
+      const char *out = out_file, *err = err_file;
+      if (m == 0) { //keep the baseline
+        rename(out_file, base_out);
+        rename(err_file, base_err);
+        out = base_out;
+        err = base_err;
+      }
+      int same = sameFile(out, base_out) && (modes[m].quiet || sameFile(err, base_err));
+      int same_ref = ref_ok && sameFile(out, ref_out) && sameFile(err, ref_err);
+      printf("%10.1f %9.2f  %s, %s reference\n", mb / r.secs, (double)r.cycles / st.st_size,
+             same ? "same as serial" : "DIFFERS FROM SERIAL",
+             !ref_ok ? "no" : same_ref ? "same as" : "differs from");
+      failed += !same;
+    }
+  }
+
+  char cmd[128];
+  snprintf(cmd, sizeof cmd, "rm -rf '%s'", dir);
+  if (system(cmd) != 0) fprintf(stderr, "cannot remove %s\n", dir);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,381 @@
+// fuzz.c
+//
+// Differential fuzzing of decomment. Generates random C-like inputs of several classes, each biased
+// toward the cases a decommenter gets wrong, runs every decomment mode and the reference binary on
+// each input, and compares standard output, standard error and the exit code:
+//   - every mode must reproduce the serial scalar mode exactly (the -q modes: standard output and
+//     exit code). A difference is a bug in a fast path: the input is kept and fuzz fails.
+//   - the serial scalar mode is compared with the reference. decomment keeps the original
+//     assignment's behaviour where the two differ (e.g. it always exits with 0), so these
+//     differences are counted per class and the first few inputs are kept, but they only make
+//     fuzz fail with -x.
+// Then one large input of every class is generated, and the throughput of every mode and of the
+// reference on it is reported in MB/s.
+//
+// Usage: fuzz [-d decomment] [-r reference] [-n inputs] [-l maxlen] [-L largesize] [-s seed]
+//             [-k keepdir] [-x] [class...]
+//
+// Classes: nested, string, escape, stars, eof, mixed (default: all). Inputs and outputs go to a
+// fresh directory /tmp/fuzz.XXXXXX. Kept inputs are written to keepdir (default: kept/ in there,
+// and then the directory is left in place) as <class>-<n>.c. A mode that fails on empty input
+// (e.g. -s avx2 without AVX2) is reported as skipped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_ARGS 8
+#define MAX_TOKENS 64
+#define KEEP_REF 3             // inputs kept per class that differ from the reference
+
+// a way to run decomment: a name and the options that select it
+struct Mode {
+  const char *name;
+  const char *args[MAX_ARGS];
+  int quiet;                      // -q: stderr is not compared
+  int pipes;                      // stdin and stdout are pipes instead of files
+};
+
+// an input class: inputs are random sequences of its tokens (a token listed twice is picked twice
+// as often); an eof input also ends with one of the openers, so the input stops inside it
+struct Class {
+  const char *name;
+  const char *tokens[MAX_TOKENS];
+  int eof;
+};
+
+// what happened to one class
+struct Tally {
+  int inputs;
+  int mode_diffs;                 // mode runs that differ from the serial scalar mode
+  int ref_out, ref_err, ref_exit; // inputs where serial differs from the reference
+  int kept;                       // inputs kept for differing from the reference
+};
+
+static const struct Class classes[] = {
+  { "nested", { "/*", "/*", "/*", "*/", "*/", "/* /*", "*/ */", "x", "int a;", " ", "\n", "\n",
+                "/", "*", "//", NULL }, 0 },
+  { "string", { "\"", "\"", "'", "'", "\"*/\"", "\"/*\"", "'/*'", "\"//\"", "/*", "*/", "//",
+                "abc", " ", "\n", "\\\"", NULL }, 0 },
+  { "escape", { "\\", "\\", "\\\"", "\\'", "\\\\", "\"", "\"", "'", "'", "\\\n", "\n", "a", "/*",
+                "*/", "//", NULL }, 0 },
+  { "stars",  { "**/", "***", "/**", "*/*", "/*/", "*", "*", "/", "/", "**", "\n", "x", " ", NULL }, 0 },
+  { "eof",    { "/*", "*/", "//", "\"", "'", "\\", "x = 1;", "\n", "*", "/", NULL }, 1 },
+  { "mixed",  { "/*", "*/", "//", "/", "*", "\"", "'", "\\", "\\\"", "\\'", "**/", "/**/",
+                "\"*/\"", "'/*'", "int x = 1;", "return y;", " ", " ", "\n", "\n", "\t", NULL }, 0 },
+};
+#define NCLASSES (int)(sizeof classes / sizeof classes[0])
+
+// where an eof input can stop: inside a comment, a string, after a '/' or a backslash
+static const char *openers[] = { "/*", "/* x *", "//", "\"abc", "'", "/", "\"\\", "/**" };
+#define NOPENERS (int)(sizeof openers / sizeof openers[0])
+
+static char dir[] = "/tmp/fuzz.XXXXXX";
+static char in_file[32], out_file[32], err_file[32], kept_dir[32];
+static char base_out[64], base_err[64];
+static int nkept;                 // inputs kept so far
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+//xorshift64, as in gencorpus.c
+static unsigned rnd(unsigned n){
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (unsigned)(rng_state % n);
+}
+
+static double now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//writes a random input of class c, about len bytes long, to path
+static void generate(const struct Class *c, size_t len, const char *path){
+  FILE *fp = fopen(path, "wb");
+  int ntokens = 0;
+  size_t n = 0;
+
+  if (fp == NULL) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  while (c->tokens[ntokens]) ntokens++;
+  while (n < len) {
+    const char *t = c->tokens[rnd(ntokens)];
+    fputs(t, fp);
+    n += strlen(t);
+  }
+  if (c->eof) fputs(openers[rnd(NOPENERS)], fp);
+  fclose(fp);
+}
+
+//copies everything from fd in to fd out in a child process, which is returned
+static pid_t spawnCopy(int in, int out){
+  pid_t pid = fork();
+  if (pid == 0) {
+    char buf[1 << 16];
+    ssize_t n;
+    for (int fd = 3; fd < 64; fd++) //the other pipe ends must not stay open in here
+      if (fd != in && fd != out) close(fd);
+    while ((n = read(in, buf, sizeof buf)) > 0)
+      if (write(out, buf, n) != n) _exit(1);
+    _exit(0);
+  }
+  return pid;
+}
+
+//runs argv with stdin from in_file and stdout/stderr to out_file/err_file (through pipes if pipes
+//is set). Returns the exit code, or -1 if it could not run or was killed
+static int runOnce(char *const argv[], int pipes, double *secs){
+  int in = open(in_file, O_RDONLY);
+  int out = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int err = open(err_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int inpipe[2] = { -1, -1 }, outpipe[2] = { -1, -1 };
+  pid_t feeder = -1, drainer = -1;
+  double t0 = now();
+
+  if (in < 0 || out < 0 || err < 0) return -1;
+  if (pipes) { //a child feeds the input pipe, another one empties the output pipe into out_file
+    if (pipe(inpipe) < 0 || pipe(outpipe) < 0) return -1;
+    feeder = spawnCopy(in, inpipe[1]);
+    drainer = spawnCopy(outpipe[0], out);
+    close(in);
+    close(out);
+    close(inpipe[1]);
+    close(outpipe[0]);
+    in = inpipe[0];
+    out = outpipe[1];
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    dup2(in, 0); dup2(out, 1); dup2(err, 2);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  close(in);
+  close(out);
+  close(err);
+  int status;
+  if (pid < 0 || waitpid(pid, &status, 0) < 0) return -1;
+  if (feeder > 0) waitpid(feeder, NULL, 0);
+  if (drainer > 0) waitpid(drainer, NULL, 0);
+
+  *secs = now() - t0;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) return -1;
+  return WEXITSTATUS(status);
+}
+
+//runs a mode on in_file once (or repeat times, keeping the fastest). Returns the exit code
+static int runMode(const char *bin, const struct Mode *m, int repeat, double *secs){
+  char *argv[MAX_ARGS + 2];
+  int n = 0, code = -1;
+
+  argv[n++] = (char *)bin;
+  for (int i = 0; m->args[i]; i++) argv[n++] = (char *)m->args[i];
+  argv[n] = NULL;
+
+  *secs = 1e30;
+  for (int k = 0; k < repeat; k++) {
+    double s;
+    code = runOnce(argv, m->pipes, &s);
+    if (code < 0) return -1;
+    if (s < *secs) *secs = s;
+  }
+  return code;
+}
+
+//returns 1 if the two files have the same contents
+static int sameFile(const char *a, const char *b){
+  FILE *fa = fopen(a, "rb"), *fb = fopen(b, "rb");
+  int same = fa && fb;
+  char ba[1 << 15], bb[1 << 15];
+
+  while (same) {
+    size_t na = fread(ba, 1, sizeof ba, fa), nb = fread(bb, 1, sizeof bb, fb);
+    same = na == nb && !memcmp(ba, bb, na);
+    if (na == 0) break;
+  }
+  if (fa) fclose(fa);
+  if (fb) fclose(fb);
+  return same;
+}
+
+//returns 1 if the file is empty (or missing)
+static int emptyFile(const char *path){
+  struct stat st;
+  return stat(path, &st) < 0 || st.st_size == 0;
+}
+
+//copies in_file to keepdir/<class>-<n>.c
+static void keep(const char *keepdir, const char *class, int n){
+  char path[4096], cmd[8300];
+  mkdir(keepdir, 0755);
+  snprintf(path, sizeof path, "%s/%s-%d.c", keepdir, class, n);
+  snprintf(cmd, sizeof cmd, "cp '%s' '%s'", in_file, path);
+  if (system(cmd) != 0) fprintf(stderr, "cannot keep %s\n", path);
+  else nkept++;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *decomment = "bin/decomment", *reference = "reference/sampledecomment";
+  const char *keepdir = kept_dir;
+  int ninputs = 200, strict = 0, failed = 0, i;
+  size_t maxlen = 2048, largesize = 4 << 20;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (!strcmp(argv[i], "-x")) strict = 1;
+    else if (i + 1 == argc) break; //an option without its value
+    else if (!strcmp(argv[i], "-d")) decomment = argv[++i];
+    else if (!strcmp(argv[i], "-r")) reference = argv[++i];
+    else if (!strcmp(argv[i], "-n")) ninputs = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-l")) maxlen = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "-L")) largesize = strtoul(argv[++i], NULL, 10);
+    else if (!strcmp(argv[i], "-s")) rng_state ^= strtoull(argv[++i], NULL, 10) * 0x9E3779B97F4A7C15ULL;
+    else if (!strcmp(argv[i], "-k")) keepdir = argv[++i];
+    else break;
+  }
+  if ((i < argc && argv[i][0] == '-') || ninputs < 0 || maxlen < 1 || rng_state == 0) {
+    fprintf(stderr, "Usage: %s [-d decomment] [-r reference] [-n inputs] [-l maxlen] [-L largesize]\n"
+                    "       [-s seed] [-k keepdir] [-x] [class...]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  //which classes: the ones named on the command line, or all
+  int use[NCLASSES], any = i < argc;
+  for (int c = 0; c < NCLASSES; c++) {
+    use[c] = !any;
+    for (int k = i; k < argc; k++) use[c] |= !strcmp(argv[k], classes[c].name);
+  }
+  for (int k = i; k < argc; k++) {
+    int known = 0;
+    for (int c = 0; c < NCLASSES; c++) known |= !strcmp(argv[k], classes[c].name);
+    if (!known) {
+      fprintf(stderr, "Unknown class '%s'.\n", argv[k]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  const struct Mode modes[] = { //the first one is the baseline the others are compared with
+    { "serial-scalar", { "-i", "stream", "-s", "scalar", NULL }, 0, 0 },
+    { "serial-sse2",   { "-i", "stream", "-s", "sse2", NULL }, 0, 0 },
+    { "serial-avx2",   { "-i", "stream", "-s", "avx2", NULL }, 0, 0 },
+    { "small-blocks",  { "-i", "stream", "-b", "16", NULL }, 0, 0 },
+    { "table",         { "-i", "stream", "-m", "table", NULL }, 0, 0 },
+    { "mmap",          { "-i", "mmap", NULL }, 0, 0 },
+    { "uring-b64",     { "-i", "uring", "-b", "64", NULL }, 0, 0 },    //many blocks in flight
+    { "threads-b64",   { "-i", "threads", "-b", "64", NULL }, 0, 0 },
+    { "parallel",      { "-j", "4", NULL }, 0, 0 },
+    { "splice",        { "-i", "splice", NULL }, 0, 1 },
+    { "nolines",       { "-i", "stream", "-q", NULL }, 1, 0 },
+    { "mmap-nolines",  { "-i", "mmap", "-q", NULL }, 1, 0 },
+  };
+  const struct Mode ref = { "reference", { NULL }, 0, 0 };
+  int nmodes = sizeof modes / sizeof modes[0];
+  int usable[sizeof modes / sizeof modes[0]];
+  struct Tally tally[NCLASSES];
+  double secs;
+
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+  snprintf(in_file, sizeof in_file, "%s/in", dir);
+  snprintf(out_file, sizeof out_file, "%s/out", dir);
+  snprintf(err_file, sizeof err_file, "%s/err", dir);
+  snprintf(kept_dir, sizeof kept_dir, "%s/kept", dir);
+  snprintf(base_out, sizeof base_out, "%s.base", out_file);
+  snprintf(base_err, sizeof base_err, "%s.base", err_file);
+  memset(tally, 0, sizeof tally);
+
+  //a mode that does not run at all (e.g. no AVX2 here) is left out: it has to succeed on empty
+  //input. Any exit code counts later, as decomment fails on an unterminated comment
+  generate(&classes[0], 0, in_file);
+  for (int m = 0; m < nmodes; m++) {
+    usable[m] = runMode(decomment, &modes[m], 1, &secs) == 0;
+    if (!usable[m]) printf("%-14s skipped (not supported here)\n", modes[m].name);
+  }
+  if (!usable[0]) {
+    fprintf(stderr, "%s does not run.\n", decomment);
+    return EXIT_FAILURE;
+  }
+  int have_ref = runMode(reference, &ref, 1, &secs) == 0;
+  if (!have_ref) printf("%s does not run, outputs are only compared between modes\n", reference);
+
+  for (int c = 0; c < NCLASSES; c++) { //differential runs
+    if (!use[c]) continue;
+    struct Tally *t = &tally[c];
+    for (int k = 0; k < ninputs; k++) {
+      generate(&classes[c], rnd(maxlen + 1), in_file);
+      t->inputs++;
+
+      int base = runMode(decomment, &modes[0], 1, &secs);
+      rename(out_file, base_out);
+      rename(err_file, base_err);
+      int kept = 0;
+      for (int m = 1; m < nmodes; m++) {
+        if (!usable[m]) continue;
+        int code = runMode(decomment, &modes[m], 1, &secs);
+        int same = code == base && sameFile(out_file, base_out) &&
+                   (modes[m].quiet ? emptyFile(err_file) : sameFile(err_file, base_err));
+        if (!same) {
+          printf("%s input %d: %s differs from %s\n", classes[c].name, k, modes[m].name, modes[0].name);
+          t->mode_diffs++;
+          if (!kept++) keep(keepdir, classes[c].name, k);
+        }
+      }
+
+      if (!have_ref) continue;
+      int code = runMode(reference, &ref, 1, &secs);
+      int dout = !sameFile(out_file, base_out), derr = !sameFile(err_file, base_err);
+      int dexit = code != base;
+      t->ref_out += dout;
+      t->ref_err += derr;
+      t->ref_exit += dexit;
+      if ((dout || derr || dexit) && !kept && t->kept < KEEP_REF) {
+        keep(keepdir, classes[c].name, k);
+        t->kept++;
+      }
+    }
+    failed += t->mode_diffs > 0 || (strict && t->ref_out + t->ref_err + t->ref_exit > 0);
+  }
+
+  printf("\n%-8s %7s %12s   %-36s\n", "class", "inputs", "mode diffs", "differ from reference in");
+  for (int c = 0; c < NCLASSES; c++) {
+    if (!use[c]) continue;
+    struct Tally *t = &tally[c];
+    printf("%-8s %7d %12d   ", classes[c].name, t->inputs, t->mode_diffs);
+    if (have_ref) printf("stdout %d, stderr %d, exit code %d\n", t->ref_out, t->ref_err, t->ref_exit);
+    else printf("-\n");
+  }
+
+  //throughput on one large input per class, fastest of three runs
+  printf("\n%-8s %-14s %10s\n", "class", "mode", "MB/s");
+  for (int c = 0; c < NCLASSES && largesize > 0; c++) {
+    if (!use[c]) continue;
+    generate(&classes[c], largesize, in_file);
+    struct stat st;
+    stat(in_file, &st);
+    double mb = st.st_size / 1e6;
+    if (have_ref && runMode(reference, &ref, 3, &secs) >= 0)
+      printf("%-8s %-14s %10.1f\n", classes[c].name, ref.name, mb / secs);
+    for (int m = 0; m < nmodes; m++) {
+      if (!usable[m] || runMode(decomment, &modes[m], 3, &secs) < 0) continue;
+      printf("%-8s %-14s %10.1f\n", classes[c].name, modes[m].name, mb / secs);
+    }
+  }
+
+  unlink(in_file); unlink(out_file); unlink(err_file);
+  unlink(base_out); unlink(base_err);
+  if (nkept > 0) printf("\n%d inputs kept in %s\n", nkept, keepdir);
+  rmdir(dir); //stays if the inputs were kept in it
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
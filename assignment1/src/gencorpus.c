@@ -0,0 +1,157 @@
+// gencorpus.c
+//
+// Writes a synthetic C-like corpus for benchmarking decomment to standard output.
+//
+// Usage: gencorpus class size [seed]
+//   class: mixed    - ordinary code with a comment or string every few lines
+//          comment  - license headers, doc blocks and // comments, little code
+//          string   - string and character literals, many of them containing /* and //
+//          escape   - strings full of \" \' and \\ escapes
+//          longline - lines of 8-64 KiB of code with inline comments
+//   size:  number of bytes, e.g. 4096, 64k, 16M, 1G (the corpus ends at the first line end after it)
+//
+// Every comment is closed and the last line ends with a newline, so decomment prints no error.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+//xorshift64: fast and good enough to vary the corpus
+static unsigned rnd(unsigned n){
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (unsigned)(rng_state % n);
+}
+
+static const char *words[] = {
+  "int", "char", "return", "if", "else", "while", "for", "struct", "static", "const",
+  "size_t", "buf", "len", "ptr", "state", "count", "i", "j", "result", "node",
+};
+#define NWORDS (sizeof words / sizeof words[0])
+
+static const char *lorem[] = {
+  "the", "buffer", "is", "freed", "after", "each", "call", "see", "above", "for",
+  "details", "this", "function", "returns", "zero", "on", "success", "and", "errno", "set",
+};
+#define NLOREM (sizeof lorem / sizeof lorem[0])
+
+static long long written = 0; //bytes written so far
+
+static void emit(const char *s)  { written += strlen(s); fputs(s, stdout); }
+static void emitc(char c)        { written++; putchar(c); }
+
+static void word(void)   { emit(words[rnd(NWORDS)]); }
+static void text(int n)  { while (n-- > 0) { emit(lorem[rnd(NLOREM)]); emitc(' '); } }
+
+//one line of plain code, no comments or literals
+static void codeLine(void){
+  for (int k = 2 * (1 + rnd(4)); k > 0; k--) emitc(' ');
+  word(); emitc(' '); word(); emit(" = "); word(); emit(" + "); word();
+  emit(";\n");
+}
+
+static void stringLiteral(void){
+  static const char *inner[] = { "/* not a comment */", "// nor this", "*/", "/*", "http://x", "a*b/c" };
+  emitc('"');
+  text(1 + rnd(3));
+  if (rnd(2)) emit(inner[rnd(6)]);
+  emitc('"');
+}
+
+static void escapedLiteral(void){
+  static const char *esc[] = { "\\\"", "\\'", "\\\\", "\\n", "\\t", "\\\\\\\"" };
+  char q = rnd(4) ? '"' : '\'';
+  emitc(q);
+  for (int k = 1 + rnd(6); k > 0; k--) {
+    emit(esc[rnd(6)]);
+    word();
+  }
+  emitc(q);
+}
+
+//writes one unit of the class and returns
+static void unit(const char *cls){
+  if (!strcmp(cls, "comment")) {
+    switch (rnd(4)) {
+      case 0: //license header
+        emit("/*\n");
+        for (int k = 2 + rnd(10); k > 0; k--) { emit(" * "); text(8); emitc('\n'); }
+        emit(" **/\n");
+        break;
+      case 1: emit("// "); text(6 + rnd(6)); emitc('\n'); break;
+      case 2: codeLine(); break;
+      default: emit("int x; /* "); text(3); emit("*** */ // trailing\n"); break;
+    }
+  }
+  else if (!strcmp(cls, "string")) {
+    emit("  printf(");
+    stringLiteral();
+    emit(", '/', '*', ");
+    stringLiteral();
+    emit(");\n");
+  }
+  else if (!strcmp(cls, "escape")) {
+    emit("  s = ");
+    escapedLiteral();
+    emit("; t = ");
+    escapedLiteral();
+    emit(";\n");
+  }
+  else if (!strcmp(cls, "longline")) {
+    long long stop = written + 8192 + rnd(57344); //8-64 KiB, then the newline
+    while (written < stop) {
+      word(); emit(" = "); word(); emit("; ");
+      if (rnd(16) == 0) emit("/* inline */ ");
+    }
+    emitc('\n');
+  }
+  else { //mixed
+    switch (rnd(10)) {
+      case 0: emit("/* "); text(5); emit("*/\n"); break;
+      case 1: emit("  x++; // "); text(4); emitc('\n'); break;
+      case 2: emit("  puts("); stringLiteral(); emit(");\n"); break;
+      default: codeLine(); break;
+    }
+  }
+}
+
+//parses a size like "4096", "64k", "16M" or "1G"
+static long long parseSize(const char *s){
+  char *end;
+  long long v = strtoll(s, &end, 10);
+  switch (tolower((unsigned char)*end)) {
+    case 'k': v <<= 10; end++; break;
+    case 'm': v <<= 20; end++; break;
+    case 'g': v <<= 30; end++; break;
+    default: break;
+  }
+  return (*end == '\0' && end != s) ? v : -1;
+}
+
+int main(int argc, char *argv[])
+{
+  static const char *classes[] = { "mixed", "comment", "string", "escape", "longline" };
+  int known = 0;
+
+  if (argc < 3 || argc > 4) {
+    fprintf(stderr, "Usage: %s mixed|comment|string|escape|longline size [seed]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < 5; i++) known |= !strcmp(argv[1], classes[i]);
+  long long size = parseSize(argv[2]);
+  if (!known || size < 0) {
+    fprintf(stderr, "Invalid class '%s' or size '%s'.\n", argv[1], argv[2]);
+    return EXIT_FAILURE;
+  }
+  if (argc == 4) rng_state ^= strtoull(argv[3], NULL, 10) * 0x9E3779B97F4A7C15ULL;
+
+  static char obuf[1 << 16];
+  setvbuf(stdout, obuf, _IOFBF, sizeof obuf);
+
+  while (written < size) unit(argv[1]);
+  return EXIT_SUCCESS;
+}
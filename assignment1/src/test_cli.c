@@ -0,0 +1,194 @@
+// test_cli.c
+//
+// Runs the decomment command on small inputs and checks its output, exit code and what it leaves of
+// its input:
+//   - client: input of which a few bytes were already read is decommented from there on, and read
+//     to its end, by a local run, by --client and through $DECOMMENT_SOCKET alike.
+//   - edit: --edit takes a range start,end; anything else is rejected before the input is read.
+//
+// Usage: test_cli decomment
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define MAX_OUT 4096
+
+static const char *decomment;
+static char dir[] = "/tmp/test_cli.XXXXXX";
+static char in_file[64], out_file[64], err_file[64], sock_path[64], index_file[64], prev_file[64];
+static int failed;
+
+// what one run did
+struct Run {
+  int code;                 // exit code, -1 if it did not exit normally
+  char out[MAX_OUT];        // standard output
+  off_t left;               // offset of the input after the run
+};
+
+//writes text to path
+static void writeFile(const char *path, const char *text){
+  FILE *fp = fopen(path, "wb");
+  if (fp == NULL || fputs(text, fp) == EOF || fclose(fp) != 0) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+}
+
+//runs decomment with args on in_file, the first skip bytes of which are read beforehand, with
+//DECOMMENT_SOCKET set to env (unset if NULL). Its standard error goes to err_file
+static struct Run run(const char *const args[], size_t skip, const char *env){
+  struct Run r = { -1, "", 0 };
+  char *argv[8], buf[64];
+  int n = 0;
+
+  argv[n++] = (char *)decomment;
+  for (int i = 0; args[i]; i++) argv[n++] = (char *)args[i];
+  argv[n] = NULL;
+
+  int in = open(in_file, O_RDONLY);
+  int out = open(out_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int err = open(err_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (in < 0 || out < 0 || err < 0 || read(in, buf, skip) != (ssize_t)skip) {
+    perror(in_file);
+    exit(EXIT_FAILURE);
+  }
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (env) setenv("DECOMMENT_SOCKET", env, 1);
+    else unsetenv("DECOMMENT_SOCKET");
+    dup2(in, 0); dup2(out, 1); dup2(err, 2);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  int status;
+  if (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)) r.code = WEXITSTATUS(status);
+  r.left = lseek(in, 0, SEEK_CUR); //the child shared the offset
+  close(in);
+  close(out);
+  close(err);
+
+  FILE *fp = fopen(out_file, "rb");
+  if (fp) {
+    r.out[fread(r.out, 1, sizeof r.out - 1, fp)] = '\0';
+    fclose(fp);
+  }
+  return r;
+}
+
+//prints and counts the outcome of one check
+static void check(int ok, const char *name, const char *what){
+  printf("[%s] %-6s %s\n", ok ? "PASS" : "FAIL", name, what);
+  failed += !ok;
+}
+
+//starts decomment --serve on sock_path and waits until it accepts connections
+static pid_t startServer(void){
+  pid_t pid = fork();
+  if (pid == 0) {
+    execl(decomment, decomment, "--serve", sock_path, (char *)NULL);
+    _exit(127);
+  }
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, sock_path);
+  for (int tries = 0; tries < 500; tries++) {
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    int up = s >= 0 && connect(s, (struct sockaddr *)&addr, sizeof addr) == 0;
+    if (s >= 0) close(s);
+    if (up) return pid;
+    usleep(10000);
+  }
+  fprintf(stderr, "The server at '%s' does not come up.\n", sock_path);
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+  exit(EXIT_FAILURE);
+}
+
+//client: a partly read input is decommented from its offset, by the server too
+static void testClient(void){
+  static const char text[] = "abcdefg/* c */hij\n";
+  static const char *const local[] = { NULL };
+  static const char *const client[] = { "--client", sock_path, NULL };
+  char what[64];
+
+  writeFile(in_file, text);
+  pid_t server = startServer();
+  for (size_t skip = 0; skip <= 3; skip += 3) {
+    struct Run want = run(local, skip, NULL);
+    struct Run got = run(client, skip, NULL), env = run(local, skip, sock_path);
+
+    snprintf(what, sizeof what, "local, %zu bytes read before", skip);
+    check(want.code == 0 && !strcmp(want.out, skip ? "defg hij\n" : "abcdefg hij\n") &&
+          want.left == (off_t)strlen(text), "client", what);
+    snprintf(what, sizeof what, "--client, %zu bytes read before", skip);
+    check(got.code == 0 && !strcmp(got.out, want.out) && got.left == want.left, "client", what);
+    snprintf(what, sizeof what, "$DECOMMENT_SOCKET, %zu bytes read before", skip);
+    check(env.code == 0 && !strcmp(env.out, want.out) && env.left == want.left, "client", what);
+  }
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+  unlink(sock_path);
+}
+
+//edit: --edit start,end is checked before the checkpoints are used
+static void testEdit(void){
+  static const char text[] = "int a; /* one */\nint b; // two\n";
+  static const char *const bad[] = { "3", "3,", "0,", ",5", "5,3", "3,5x", "x" };
+  static const char *const write[] = { "--checkpoint", index_file, NULL };
+  char what[64];
+
+  writeFile(in_file, text);
+  struct Run first = run(write, 0, NULL);
+  rename(out_file, prev_file);
+  check(first.code == 0, "edit", "--checkpoint writes the index");
+
+  const char *args[] = { "--checkpoint", index_file, "--previous", prev_file, "--edit", "3,5", NULL };
+  struct Run good = run(args, 0, NULL);
+  check(good.code == 0 && !strcmp(good.out, first.out), "edit", "--edit 3,5");
+  for (size_t k = 0; k < sizeof bad / sizeof bad[0]; k++) {
+    args[5] = bad[k];
+    struct Run r = run(args, 0, NULL);
+    snprintf(what, sizeof what, "--edit %s is rejected", bad[k]);
+    check(r.code == EXIT_FAILURE && r.out[0] == '\0', "edit", what);
+  }
+  unlink(index_file);
+  unlink(prev_file);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s decomment\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  decomment = argv[1];
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+  snprintf(in_file, sizeof in_file, "%s/in.c", dir);
+  snprintf(out_file, sizeof out_file, "%s/out", dir);
+  snprintf(err_file, sizeof err_file, "%s/err", dir);
+  snprintf(sock_path, sizeof sock_path, "%s/sock", dir);
+  snprintf(index_file, sizeof index_file, "%s/index", dir);
+  snprintf(prev_file, sizeof prev_file, "%s/prev", dir);
+
+  testClient();
+  testEdit();
+
+  unlink(in_file);
+  unlink(out_file);
+  unlink(err_file);
+  rmdir(dir);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
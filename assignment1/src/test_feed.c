@@ -0,0 +1,96 @@
+// test_feed.c
+//
+// Feeds each input file to the incremental API (dfa.h) in pieces of random size and checks that the
+// output and the unterminated-comment line are the same as when the whole file is fed at once, for
+// both DFA cores.
+//
+// Usage: test_feed file...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "dfa.h"
+
+#define ROUNDS 20             // random splits tried per file and core
+
+// output collected by the callback
+struct Sink {
+  char *buf;
+  size_t len, cap;
+};
+
+static void collect(void *arg, const char *data, size_t len){
+  struct Sink *s = arg;
+  if (s->len + len > s->cap) {
+    s->cap = (s->len + len) * 2;
+    s->buf = realloc(s->buf, s->cap);
+    assert(s->buf != NULL);
+  }
+  memcpy(s->buf + s->len, data, len);
+  s->len += len;
+}
+
+//decomments in[0..n) in pieces of at most maxpiece bytes (0: all at once) into *s.
+//Returns what decomment_finish() returns
+static int run(const char *in, size_t n, size_t maxpiece, struct Sink *s){
+  struct decomment_ctx ctx;
+  int rc = decomment_ctx_init(&ctx, 64);
+  assert(rc == 0);
+
+  s->len = 0;
+  for (size_t off = 0; off < n; ) {
+    size_t len = maxpiece ? 1 + (size_t)rand() % maxpiece : n;
+    if (len > n - off) len = n - off;
+    decomment_feed(&ctx, in + off, len, collect, s);
+    off += len;
+  }
+  int line = decomment_finish(&ctx, collect, s);
+  decomment_ctx_free(&ctx);
+  return line;
+}
+
+//reads a whole file into a malloc'd buffer
+static char *slurp(const char *path, size_t *n){
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) { perror(path); exit(EXIT_FAILURE); }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  char *buf = malloc(size + 1);
+  assert(buf != NULL);
+  *n = fread(buf, 1, size, fp);
+  fclose(fp);
+  return buf;
+}
+
+int main(int argc, char *argv[])
+{
+  static const CoreFn cores[] = { decommentBlock, decommentTable };
+  static const char *names[] = { "switch", "table" };
+  struct Sink whole = { 0 }, pieces = { 0 };
+  int failed = 0;
+
+  srand(217);
+  for (int i = 1; i < argc; i++) {
+    size_t n;
+    char *in = slurp(argv[i], &n);
+
+    for (int c = 0; c < 2; c++) {
+      decomment = cores[c];
+      int line = run(in, n, 0, &whole);
+      int ok = 1;
+
+      for (int r = 0; r < ROUNDS && ok; r++) {
+        int line2 = run(in, n, 1 + r * r, &pieces); //pieces of 1 byte up to a few hundred
+        ok = line2 == line && pieces.len == whole.len && !memcmp(pieces.buf, whole.buf, whole.len);
+      }
+      printf("[%s] %-6s %s\n", ok ? "PASS" : "FAIL", names[c], argv[i]);
+      failed += !ok;
+    }
+    free(in);
+  }
+  free(whole.buf);
+  free(pieces.buf);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
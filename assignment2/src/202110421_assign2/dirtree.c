@@ -20,16 +20,25 @@
 #include <assert.h>
 #include <grp.h>
 #include <pwd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
 
 /// @brief output control flags
 #define F_DEPTH    0x1        ///< print directory tree
 #define F_Filter   0x2        ///< pattern matching
+#define F_Prewarm  0x4        ///< load the user and group names from /etc/passwd and /etc/group
+#define F_Stats    0x8        ///< print pattern matching statistics
 
 /// @brief maximum numbers
 #define MAX_DIR 64            ///< maximum number of supported directories
-#define MAX_PATH_LEN 1024     ///< maximum length of a path
 #define MAX_DEPTH 20          ///< maximum depth of directory tree (for -d option)
+#define MAX_THREADS 64        ///< maximum number of threads (for -j option)
+#define DIRENT_BUF (1 << 16)  ///< bytes asked from getdents64 at a time
 int max_depth = MAX_DEPTH;    ///< maximum depth of directory tree (for -d option)
+int nthreads = 1;             ///< number of threads traversing the trees (for -j option)
 
 /// @brief struct holding the summary
 struct summary {
@@ -65,25 +74,101 @@ void panic(const char* msg, const char* format)
   exit(EXIT_FAILURE);
 }
 
+/// @brief one record of getdents64
+struct linux_dirent64 {
+  uint64_t d_ino;             ///< inode number
+  int64_t d_off;              ///< offset of the next record
+  unsigned short d_reclen;    ///< length of this record
+  unsigned char d_type;       ///< file type (DT_*)
+  char d_name[];              ///< name, null-terminated
+};
+
+/// @brief an open directory, read with getdents64
+struct dir_reader {
+  int fd;                     ///< the directory
+  char *buf;                  ///< records read (DIRENT_BUF bytes)
+  long len;                   ///< number of bytes in buf
+  long pos;                   ///< next record in buf
+};
+
 /// @brief read next directory entry from open directory 'dir'. Ignores '.' and '..' entries
-/// @param dir open DIR* stream
+/// @param dir open directory
 /// @retval entry on success
 /// @retval NULL on error or if there are no more entries
-struct dirent *get_next(DIR *dir) // A helper function to read the next entry (skipping . and ..)
+struct linux_dirent64 *get_next(struct dir_reader *dir) // A helper function to read the next entry (skipping . and ..)
 {
-  struct dirent *next;
+  struct linux_dirent64 *next;
   int ignore;
 
   do {
-    errno = 0;
-    next = readdir(dir);
-    if (errno != 0) perror(NULL);
-    ignore = next && ((strcmp(next->d_name, ".") == 0) || (strcmp(next->d_name, "..") == 0));
-  } while (next && ignore);
+    if (dir->pos == dir->len) {                     // refill the buffer
+      dir->len = syscall(SYS_getdents64, dir->fd, dir->buf, DIRENT_BUF);
+      dir->pos = 0;
+      if (dir->len < 0) perror(NULL);
+      if (dir->len <= 0) {
+        dir->len = 0;
+        return NULL;
+      }
+    }
+    next = (struct linux_dirent64 *)(dir->buf + dir->pos);
+    dir->pos += next->d_reclen;
+    ignore = (strcmp(next->d_name, ".") == 0) || (strcmp(next->d_name, "..") == 0);
+  } while (ignore);
 
   return next;
 }
 
+/// @brief a directory entry, as kept in the arena
+struct entry {
+  uint64_t ino;               ///< inode number
+  uint32_t name;              ///< offset of the name in the arena's names
+  unsigned char type;         ///< file type (DT_*)
+};
+
+/// @brief entries of the directories being traversed. The entries of a directory are appended to
+/// those of its parent and dropped when it is done, so the arrays grow to the largest path of
+/// directories in the tree and are reused from then on. One arena per thread.
+struct arena {
+  struct entry *entries;      ///< the entries
+  size_t n;                   ///< number of entries
+  size_t cap;                 ///< size of entries
+  char *names;                ///< names of the entries, null-terminated, one after the other
+  size_t len;                 ///< number of bytes in names
+  size_t size;                ///< size of names
+  char *buf;                  ///< buffer of the directory being read (DIRENT_BUF bytes)
+};
+
+/// @brief append a directory entry to the arena
+/// @param a arena
+/// @param d entry
+static void arena_add(struct arena *a, const struct linux_dirent64 *d)
+{
+  size_t len = strlen(d->d_name) + 1;
+
+  if (a->n == a->cap) {
+    a->cap = a->cap ? a->cap * 2 : 256;
+    a->entries = realloc(a->entries, a->cap * sizeof *a->entries);
+    if (a->entries == NULL) panic("Out of memory.", NULL);
+  }
+  if (a->len + len > a->size) {
+    while (a->len + len > a->size) a->size = a->size ? a->size * 2 : 4096;
+    a->names = realloc(a->names, a->size);
+    if (a->names == NULL) panic("Out of memory.", NULL);
+  }
+  memcpy(a->names + a->len, d->d_name, len);
+  a->entries[a->n++] = (struct entry){ d->d_ino, (uint32_t)a->len, d->d_type };
+  a->len += len;
+}
+
+/// @brief free the memory of an arena
+/// @param a arena
+static void arena_free(struct arena *a)
+{
+  free(a->entries);
+  free(a->names);
+  free(a->buf);
+}
+
 const char *find_close(const char *p) { //function that returns pointer to closing bracket )
   int depth = 1;                        // start with 1 because we're seeing one '(' (although we're not using nested brackets)
   for (p = p + 1; *p; p++) {            // traverse through string
@@ -96,250 +181,640 @@ const char *find_close(const char *p) { //function that returns pointer to closi
   return NULL;                        // no match
 }
 
-const char *check_repetition_match(const char *s, const char *p, int unit_len)
+/// @brief instructions of a compiled pattern
+enum {
+  OP_END,                     ///< end of the pattern: match
+  OP_STAR,                    ///< bare '*': skip it, or consume a character and stay
+  OP_REPEAT,                  ///< 'x*': any number of the literal character c
+  OP_GROUP,                   ///< '(...)': the contents once, literally ('?' matches anything)
+  OP_GROUP_STAR,              ///< '(...)*': as many copies of the contents as there are, greedily
+  OP_CHAR,                    ///< a literal character c
+  OP_ANY,                     ///< '?'
+};
+
+/// @brief instruction of a compiled pattern. There is one for every position of the pattern; the
+/// matcher only runs those that can be reached from the start.
+struct pinstr {
+  unsigned char op;           ///< OP_*
+  unsigned char c;            ///< OP_REPEAT, OP_CHAR: the character
+  unsigned char guard;        ///< OP_GROUP_STAR: literal that must follow the copies, 0 if none
+  unsigned char at_end;       ///< result at the end of the name (what is left can match nothing)
+  short next;                 ///< position of the next instruction
+  short unit;                 ///< OP_GROUP(_STAR): position of the contents
+  short len;                  ///< OP_GROUP(_STAR): length of the contents
+};
+
+/// @brief a compiled pattern
+struct program {
+  struct pinstr *ins;         ///< instruction of every position (len + 1)
+  short *order;               ///< positions that can be reached, last first
+  int norder;                 ///< number of positions in order
+  int len;                    ///< length of the pattern
+  int is_only_group;          ///< the pattern is "(...)*": the empty name matches
+  char *literal;              ///< longest literal every matching name contains ("" if none)
+  int literal_len;            ///< length of literal
+  unsigned long long tested;  ///< names matched against the pattern (atomic)
+  unsigned long long rejected;///< names rejected because they do not contain literal (atomic)
+};
+static struct program prog;   ///< the -f pattern
+
+/// @brief validate a pattern and compile it into prog. Aborts with "Invalid pattern syntax" if
+/// the pattern is empty, starts with '*', has "**", an unbalanced parenthesis or an empty group.
+///
+/// The matcher follows the recursive backtracking definition of the pattern language (see match()),
+/// but every instruction is evaluated once per position of the name, so matching takes time linear
+/// in the length of the name.
+/// @param pattern pattern
+static void compile_pattern(const char *pattern)
 {
-  const char *end_of_run = s;                     // end of run: how far we've scanned so far within s
-  int run_count = 0;                              // how many repetitions we've been through
-  while(1) {
-    int matches_count = 0;                       // counter for how many matches there were so far
-    const char *s_current = end_of_run;          // current position within s
-    const char *p_current = p;                   // current position within p
-    // Try to match one full copy of the unit
-    while (matches_count < unit_len && *s_current && *p_current && (*s_current == *p_current || *p_current == '?')) {  //if we haven't matched all of the pattern yet, but we still have remaining characters to match, continue
-      ++matches_count;
-      ++s_current;
-      ++p_current;
-    }
-    if (matches_count == unit_len) {            //if all were matched, move end_of_run to check for the next copy
-      run_count++;
-      end_of_run = s_current;
-    } else {                                    // if match fails halfway through scanning, return null
-      if(matches_count != 0 && run_count == 0){
-        return NULL;
-      }
-      return end_of_run;                      //else, that was the maximum matches we could find, so return
-    }
+  // handling cases for invalid pattern syntax
+  if (*pattern == '*' || *pattern == '\0') panic("Invalid pattern syntax", NULL);  //if pattern starts with * or is empty
+  for (const char *q = pattern; *q; ++q) {
+    if (*q == '*' && q[1] == '*') panic("Invalid pattern syntax", NULL);           //if pattern has double **
+    if (*q == '(') {                            //if pattern has unbalanced ( or ), or has empty group
+      const char *close = find_close(q);
+      if (!close || close == q + 1) panic("Invalid pattern syntax", NULL);
+      q = close;
     }
-}
+    else if (*q == ')') panic("Invalid pattern syntax", NULL);                     // stray ')'
+  }
 
-static int submatch(const char *s, const char *p, int is_only_group){
-  while (*p != '\0'){       
-    if (*s == '\0') {
-      // if search keyword is "", and if pattern can be skipped (like (abc)* or x* repeated), treat as match. Else, return 0
-      while (*p) {
-        if (*p == '*') { p += 1; }
-        else if (*p == '(') {
-          const char *close = find_close(p);
-          if (close && *(close + 1) == '*')
-              p = close + 2; // skip (group)*
-          else
-              return 0;
-        } else
-            return 0;
-      }
-      return 1;
-    }   
-
-    if (*p == '*') { 
-      if (submatch(s, p + 1, is_only_group)) return 1;            //when getting to *, skip it -- it should not be counted/compared as a character
-      // try consuming one character and stay on '*'
-      return (*s && submatch(s + 1, p, is_only_group)) ? 1 : 0;
-    } else if (*(p + 1) == '*') {                                 //if next char is *, save current *p to test repetitions of it    
-      char c = *p;                                                // repeat this literal
-      const char *rest = p + 2;                                   // pattern after the 'x*'
-
-      if (submatch(s, rest, is_only_group)) return 1;            // try zero copies, if it works return 1
-
-      while (*s == c) {                                          // try one-or-more copies
-        s++;
-        if (submatch(s, rest, is_only_group)) return 1;
-      }
-      return 0;
-    }
-    else if (*p == '('){                           // if it could be a group
-      //endless repetition here 
-      const char* p_closed = find_close(p);        // find pointer to closing braket ), if none call stderr
-      if (p_closed == NULL) {
-        panic("Invalid pattern syntax", NULL);
-        return 0;
-      }
-      int len = (int)(p_closed - (p + 1));         // get size of substring of group
+  int len = strlen(pattern);
+  if (len > SHRT_MAX - 2) panic("Invalid pattern syntax", NULL);
+  prog.len = len;
+  prog.ins = calloc(len + 1, sizeof *prog.ins);
+  prog.order = malloc((len + 1) * sizeof *prog.order);
+  char *reached = calloc(len + 1, 1);
+  if (prog.ins == NULL || prog.order == NULL || reached == NULL) panic("Out of memory.", NULL);
 
-      const char *after = p_closed + 1;            // get first char after ')'
+  //check if the whole search keyword is a group
+  if (*pattern == '(') {
+    const char *close = find_close(pattern);
+    prog.is_only_group = close[1] == '*' && close[2] == '\0';
+  }
 
-      if (*after == '*'){                          // this group should be checked for repetition
-        const char *end = check_repetition_match(s, p + 1, len); // check group for repetition
-        if(end == NULL) return 2;
-        const char next = *(p_closed + 2);         // 
-        if (next && next != '(' && next != ')' && next != '*' && next != '?') {
-          if (*end != next) return 0;
-        }
-        return submatch(end, p_closed + 2, is_only_group);      // continue after the '*'
+  for (int j = len; j >= 0; j--) {
+    const char *p = pattern + j;
+    struct pinstr *in = &prog.ins[j];
+
+    // at the end of the name, only '*' and '(...)*' can be skipped
+    in->at_end = 1;
+    for (const char *q = p; *q && in->at_end; ) {
+      if (*q == '*') q++;
+      else if (*q == '(' && find_close(q)[1] == '*') q = find_close(q) + 2;
+      else in->at_end = 0;
+    }
+
+    // the same order of cases as the recursive definition
+    in->next = j + 1;
+    if (*p == '\0') in->op = OP_END;
+    else if (*p == '*') in->op = OP_STAR;
+    else if (p[1] == '*') {                     // 'x*' (also for '?' and '(', which are literal here)
+      in->op = OP_REPEAT;
+      in->c = *p;
+      in->next = j + 2;
+    }
+    else if (*p == '(') {
+      const char *close = find_close(p);
+      in->unit = j + 1;
+      in->len = close - p - 1;
+      if (close[1] == '*') {
+        char next = close[2];
+        in->op = OP_GROUP_STAR;
+        in->next = close - pattern + 2;
+        if (next && next != '(' && next != ')' && next != '*' && next != '?') in->guard = next;
       } else {
-        int k = 0;
-        const char *ts = s, *tp = p + 1;               // compare inner literally
-        while (k < len && *ts && *tp && (*tp == '?' || *ts == *tp)) { k++; ts++; tp++; }
-        if (k != len) return 0;                        // inner didn't match once
-
-        // advance both: we consumed the group once
-        s = ts;                                        // move input past inner
-        p = after;                                     // move pattern past ')'
-        continue;                                      // continue the while-loop in submatch
+        in->op = OP_GROUP;
+        in->next = close - pattern + 1;
       }
-    } else if (*s != *p && *p != '?') return 0;        // if it's not a star case: must match literally or be '?'. If not, return 0
+    }
+    else if (*p == '?') in->op = OP_ANY;
     else {
-      s++;
-      p++;
+      in->op = OP_CHAR;
+      in->c = *p;
     }
   }
-  while (*p == '*') p += 1;           // trailing x*
-
-  return (*p == '\0');  //if p = "", return true
-}
 
-static int match(const char *str, const char *pattern){
-  // handling cases for invalid pattern syntax 
-  if (*pattern == '*' || *pattern == '\0') {    //if pattern starts with * or is empty
-    panic("Invalid pattern syntax", NULL);
-    return 0;
+  // the positions that can be reached from the start; OP_STAR also stays where it is
+  reached[0] = 1;
+  for (int j = 0; j <= len; j++) {
+    if (reached[j] && prog.ins[j].op != OP_END) reached[prog.ins[j].next] = 1;
+  }
+  for (int j = len; j >= 0; j--) {
+    if (reached[j]) prog.order[prog.norder++] = j;
   }
-  for (const char *q = pattern; *q; ++q) {      //if pattern has double **
-    if (*q == '*' && q[1] == '*') {
-      panic("Invalid pattern syntax", NULL);
-      return 0;
+  free(reached);
+
+  // the instructions that can be reached form one path, and every literal on it has to be matched:
+  // the longest run of literals without anything else in between is in every matching name. The
+  // path is cut where the rest of the pattern can be skipped at the end of the name (at_end; this
+  // also skips "(...)*" that are matched as "(*" literally elsewhere), and at a '(...)*' that can end
+  // the search (contents of 2 or more) behind a '*' or 'x*', which counts as a match there
+  char *run = malloc(len + 1);
+  prog.literal = calloc(len + 1, 1);
+  if (run == NULL || prog.literal == NULL) panic("Out of memory.", NULL);
+  int runlen = 0, backtracks = 0;
+  for (int j = 0; ; j = prog.ins[j].next) {
+    const struct pinstr *in = &prog.ins[j];
+    int k = 0;
+
+    if (in->op == OP_STAR || in->op == OP_REPEAT) backtracks = 1;
+    if (in->at_end || (in->op == OP_GROUP_STAR && in->len > 1 && backtracks)) in = &prog.ins[len];  // (OP_END)
+
+    if (in->op == OP_CHAR) run[runlen++] = in->c;
+    else if (in->op == OP_GROUP) {              // the contents up to the first '?' continue the run
+      for (k = 0; k < in->len && pattern[in->unit + k] != '?'; k++) run[runlen++] = pattern[in->unit + k];
     }
-    if (*q == '(') {                            //if pattern has unbalanced ( or ), or has empty group
-      const char *close = find_close(q);
-      if (!close) {
-        panic("Invalid pattern syntax", NULL);
-        return 0;
+    if (in->op != OP_CHAR && (in->op != OP_GROUP || k < in->len)) {   // the run ends here
+      if (runlen > prog.literal_len) {
+        memcpy(prog.literal, run, runlen);
+        prog.literal[runlen] = '\0';
+        prog.literal_len = runlen;
       }
-      if (close == q + 1) {            // empty group "()"
-        panic("Invalid pattern syntax", NULL);
-        return 0;
+      runlen = 0;
+      if (in->op == OP_GROUP) {                 // a new run starts after the last '?' of the contents
+        for (k = in->len; k > 0 && pattern[in->unit + k - 1] != '?'; k--);
+        for (; k < in->len; k++) run[runlen++] = pattern[in->unit + k];
       }
-      q = close;                        
-    } else if (*q == ')') {             // stray ')'
-      panic("Invalid pattern syntax", NULL);
-      return 0;
     }
+    if (in->op == OP_END) break;
   }
+  free(run);
+}
 
-  //check if the whole search keyword is a group, and change is_only_group accordingly
-  const char* p_closed = find_close(pattern);
-  int is_only_group = 0;
-  if (*pattern == '(') {
-    p_closed = find_close(pattern);
-    if (p_closed && *(p_closed + 1) == '*' && *(p_closed + 2) == '\0') {
-      is_only_group = 1;
-    }
+/// @brief number of leading characters of @a s that match the contents of a group
+/// @param s name from the current position
+/// @param unit contents of the group
+/// @param len length of the contents
+/// @retval number of characters (len if the contents match)
+static int unit_prefix(const char *s, const char *unit, int len)
+{
+  int k = 0;
+  while (k < len && s[k] && (s[k] == unit[k] || unit[k] == '?')) k++;
+  return k;
+}
+
+/// @brief match a name against the compiled pattern
+///
+/// The pattern matches if it matches at some position of the name; at every position the pattern
+/// is tried with backtracking: a bare '*' skips any number of characters, 'x*' any number of x's,
+/// a group '(...)' must match once and '(...)*' takes as many copies as there are, without giving
+/// any back (then the character after it, if it is a literal, must follow). A group that matches
+/// only partly at the first copy ends the whole search without a match. At the end of the name,
+/// what is left of the pattern must consist of '*' and '(...)*' only.
+///
+/// Here the result at every (position in the name, instruction) is computed once, from the end
+/// of the name to the start, so the time is linear in the length of the name.
+/// @param str name
+/// @param pattern the source of the compiled pattern
+/// @retval 1 if the name matches, 0 otherwise
+static int match(const char *str, const char *pattern)
+{
+  int n = strlen(str), width = prog.len + 1;
+
+  if (prog.is_only_group && n == 0) return 1;
+
+  // names without the literal cannot match
+  __atomic_add_fetch(&prog.tested, 1, __ATOMIC_RELAXED);
+  if (prog.literal_len > 0 && memmem(str, n, prog.literal, prog.literal_len) == NULL) {
+    __atomic_add_fetch(&prog.rejected, 1, __ATOMIC_RELAXED);
+    return 0;
   }
 
-  if(is_only_group && *str == '\0'){
-    return 1;
+  // val: 0 no match, 1 match, 2 no match anywhere; aux: OP_REPEAT: a copy count works,
+  // OP_GROUP_STAR: end of the greedy copies
+  unsigned char val_stack[4096];
+  int aux_stack[4096];
+  size_t cells = (size_t)(n + 1) * width;
+  unsigned char *val = cells <= 4096 ? val_stack : malloc(cells);
+  int *aux = cells <= 4096 ? aux_stack : malloc(cells * sizeof *aux);
+  if (val == NULL || aux == NULL) panic("Out of memory.", NULL);
+#define VAL(i, j) val[(size_t)(i) * width + (j)]
+#define AUX(i, j) aux[(size_t)(i) * width + (j)]
+
+  for (int k = 0; k < prog.norder; k++) {       // at the end of the name
+    int j = prog.order[k];
+    const struct pinstr *in = &prog.ins[j];
+    VAL(n, j) = in->at_end;
+    if (in->op == OP_REPEAT)          AUX(n, j) = VAL(n, in->next) != 0;
+    else if (in->op == OP_GROUP_STAR) AUX(n, j) = n;
+  }
+  for (int i = n - 1; i >= 0; i--) {
+    for (int k = 0; k < prog.norder; k++) {
+      int j = prog.order[k];
+      const struct pinstr *in = &prog.ins[j];
+      int v = 0;
+
+      switch (in->op) {
+        case OP_END:
+          v = 1;
+          break;
+        case OP_STAR:
+          v = VAL(i, j + 1) != 0 || VAL(i + 1, j) != 0;
+          break;
+        case OP_REPEAT:
+          v = AUX(i, j) = VAL(i, in->next) != 0 || (str[i] == in->c && AUX(i + 1, j));
+          break;
+        case OP_GROUP:
+          if (unit_prefix(str + i, pattern + in->unit, in->len) == in->len) v = VAL(i + in->len, in->next);
+          break;
+        case OP_GROUP_STAR: {
+          int k = unit_prefix(str + i, pattern + in->unit, in->len);
+          AUX(i, j) = (k == in->len) ? AUX(i + in->len, j) : i;
+          if (k > 0 && k < in->len) v = 2;            // the first copy matches only partly
+          else {
+            int end = AUX(i, j);
+            v = (in->guard && str[end] != in->guard) ? 0 : VAL(end, in->next);
+          }
+          break;
+        }
+        case OP_CHAR:
+          if (str[i] == in->c) v = VAL(i + 1, in->next);
+          break;
+        case OP_ANY:
+          v = VAL(i + 1, in->next);
+          break;
+      }
+      VAL(i, j) = v;
+    }
   }
 
-  do {
-    int result = submatch(str, pattern, is_only_group);
-    switch(result){
-      case 1:
-        return 1;
-      case 2:
-        return 0;
-      default:
-        break;
+  int result = 0;
+  for (int i = 0; i <= n; i++) {                // the first position where it matches (or fails for good)
+    if (VAL(i, 0) != 0) {
+      result = VAL(i, 0) == 1;
+      break;
     }
-    // if (submatch(str, pattern, is_only_group)) return 1;
-  } while (*str++);
-  return 0;
+  }
+#undef VAL
+#undef AUX
+  if (val != val_stack) free(val);
+  if (aux != aux_stack) free(aux);
+  return result;
 }
-
 /// @brief qsort comparator to sort directory entries. Sorted by name, directories first.
 /// @param a pointer to first entry
 /// @param b pointer to second entry
+/// @param names names of the arena
 /// @retval -1 if a<b
 /// @retval 0  if a==b
 /// @retval 1  if a>b
-static int dirent_compare(const void *a, const void *b)
+static int dirent_compare(const void *a, const void *b, void *names)
 {
-  struct dirent *e1 = (struct dirent*)a;
-  struct dirent *e2 = (struct dirent*)b;
+  const struct entry *e1 = a;
+  const struct entry *e2 = b;
 
   // if one of the entries is a directory, it comes first
-  if (e1->d_type != e2->d_type) {
-    if (e1->d_type == DT_DIR) return -1;
-    if (e2->d_type == DT_DIR) return 1;
+  if (e1->type != e2->type) {
+    if (e1->type == DT_DIR) return -1;
+    if (e2->type == DT_DIR) return 1;
   }
 
   // otherwise sort by name
-  return strcmp(e1->d_name, e2->d_name);
+  return strcmp((char *)names + e1->name, (char *)names + e2->name);
 }
 
-//checks if the directory's subtree has a match
-static int subtree_has_match(const char *path, const char *pstr, int depth, struct summary *stats, char typech) {
-  DIR *dir = opendir(path);
-  if (!dir) return 0;
+/// @brief growing buffer of output lines
+struct text {
+  char *buf;                  ///< the lines
+  size_t len;                 ///< number of bytes in buf
+  size_t cap;                 ///< size of buf
+};
 
-  struct dirent *e;
-  char full[MAX_PATH_LEN];
-  int found = 0;
+/// @brief append printf output to a text buffer
+/// @param t text buffer
+/// @param format printf format string
+/// @param ap arguments of the format string
+static void text_vprintf(struct text *t, const char *format, va_list ap)
+{
+  va_list again;
+
+  va_copy(again, ap);
+  int n = vsnprintf(t->buf + t->len, t->cap - t->len, format, ap);
+  if (t->len + n >= t->cap) {                       // did not fit, grow the buffer and print again
+    while (t->len + n >= t->cap) t->cap = t->cap ? t->cap * 2 : 4096;
+    t->buf = realloc(t->buf, t->cap);
+    if (t->buf == NULL) panic("Out of memory.", NULL);
+    vsnprintf(t->buf + t->len, t->cap - t->len, format, again);
+  }
+  va_end(again);
+  t->len += n;
+}
+
+/// @brief print bytes [@a from, @a to) of a text buffer (an empty task has no buffer at all)
+/// @param t text buffer
+/// @param from first byte
+/// @param to end of the bytes
+static void text_write(const struct text *t, size_t from, size_t to)
+{
+  if (to > from) fwrite(t->buf + from, 1, to - from, stdout);
+}
+
+/// @brief output of the filter mode. The line of a directory whose own name does not match is only
+/// printed if something below it matches, so that line and everything after it are held here until
+/// the directory has been traversed.
+struct filter_output {
+  struct text held;           ///< lines that may still be dropped
+  int pending;                ///< directories being traversed whose line may still be dropped
+};
+static struct filter_output fout;
+
+/// @brief end a directory whose line was held in fout (starting at offset @a mark)
+/// @param mark length of fout before the directory's line
+/// @param keep 1 to keep the line and what was printed after it, 0 to drop them
+static void filter_release(size_t mark, int keep)
+{
+  fout.pending--;
+  if (!keep) fout.held.len = mark;
+  if (fout.pending == 0 && fout.held.len > 0) {     // nothing is held anymore
+    fwrite(fout.held.buf, 1, fout.held.len, stdout);
+    fout.held.len = 0;
+  }
+}
+
+/// @brief build the name column of an entry (indent + name). A column of @a limit characters or more
+/// is cut to 54, the last 3 replaced by "..."
+/// @param namecol output buffer (256 bytes)
+/// @param depth depth of the entry
+/// @param name name of the entry
+/// @param limit shortest column that is cut
+static void name_column(char *namecol, int depth, const char *name, int limit)
+{
+  int written = snprintf(namecol, 256, "%*s%s", depth * 2, "", name);
+  if (written >= limit) {
+    namecol[51] = '.';
+    namecol[52] = '.';
+    namecol[53] = '.';
+    namecol[54] = '\0';
+  }
+}
 
-  while ((e = get_next(dir)) != NULL) {
-    if (match(e->d_name, pstr)) { 
-      found = 1; break; 
+/// @brief cache of user or group names by id. Open addressing with linear probing; the names are
+/// interned (allocated once and never freed), so the pointers handed out stay valid.
+struct name_cache {
+  pthread_rwlock_t lock;
+  unsigned int *ids;          ///< id of every slot
+  const char **names;         ///< name of every slot, NULL if the slot is free
+  size_t cap;                 ///< number of slots (a power of two)
+  size_t n;                   ///< number of slots used
+};
+static struct name_cache users = { PTHREAD_RWLOCK_INITIALIZER, NULL, NULL, 0, 0 };
+static struct name_cache groups = { PTHREAD_RWLOCK_INITIALIZER, NULL, NULL, 0, 0 };
+
+/// @brief find the slot of an id: the one holding it, or the free one where it would go
+/// @param c cache (with at least one free slot)
+/// @param id user or group id
+/// @retval index of the slot
+static size_t cache_slot(const struct name_cache *c, unsigned int id)
+{
+  size_t i = (id * 2654435761u) & (c->cap - 1);
+  while (c->names[i] && c->ids[i] != id) i = (i + 1) & (c->cap - 1);
+  return i;
+}
+
+/// @brief add a name to a cache unless the id is already there. Call with the write lock held
+/// @param c cache
+/// @param id user or group id
+/// @param name name (copied)
+/// @retval the cached name of the id
+static const char *cache_insert(struct name_cache *c, unsigned int id, const char *name)
+{
+  if ((c->n + 1) * 4 > c->cap * 3) {                // keep it at most 3/4 full
+    struct name_cache old = *c;
+    c->cap = old.cap ? old.cap * 2 : 256;
+    c->ids = calloc(c->cap, sizeof *c->ids);
+    c->names = calloc(c->cap, sizeof *c->names);
+    if (c->ids == NULL || c->names == NULL) panic("Out of memory.", NULL);
+    for (size_t i = 0; i < old.cap; i++) {
+      if (old.names[i] == NULL) continue;
+      size_t j = cache_slot(c, old.ids[i]);
+      c->ids[j] = old.ids[i];
+      c->names[j] = old.names[i];
     }
+    free(old.ids);
+    free(old.names);
+  }
+
+  size_t i = cache_slot(c, id);
+  if (c->names[i] == NULL) {
+    if ((c->names[i] = strdup(name)) == NULL) panic("Out of memory.", NULL);
+    c->ids[i] = id;
+    c->n++;
+  }
+  return c->names[i];
+}
+
+/// @brief look up the name of a user (@a is_group = 0) or group id, through the cache
+/// @param c cache
+/// @param id user or group id
+/// @param is_group 1 for a group id
+/// @retval the name, "?" if there is none or it cannot be looked up (only the former is cached)
+static const char *cache_lookup(struct name_cache *c, unsigned int id, int is_group)
+{
+  const char *name = NULL;
+
+  pthread_rwlock_rdlock(&c->lock);
+  if (c->cap > 0) name = c->names[cache_slot(c, id)];
+  pthread_rwlock_unlock(&c->lock);
+  if (name) return name;
+
+  // not cached yet: ask NSS, with a bigger buffer as long as the entry does not fit
+  long hint = sysconf(is_group ? _SC_GETGR_R_SIZE_MAX : _SC_GETPW_R_SIZE_MAX);
+  size_t size = hint > 0 ? (size_t)hint : 1024;
+  struct passwd pw, *pwp = NULL;
+  struct group gr, *grp = NULL;
+  char *buf = NULL;
+  int err;
+  do {
+    free(buf);
+    if ((buf = malloc(size)) == NULL) panic("Out of memory.", NULL);
+    if (is_group) err = getgrgid_r(id, &gr, buf, size, &grp);
+    else          err = getpwuid_r(id, &pw, buf, size, &pwp);
+    size *= 2;
+  } while (err == ERANGE);
+
+  if (err == 0) {
+    name = is_group ? (grp ? grp->gr_name : "?") : (pwp ? pwp->pw_name : "?");
+    pthread_rwlock_wrlock(&c->lock);
+    name = cache_insert(c, id, name);
+    pthread_rwlock_unlock(&c->lock);
+  } else name = "?";                                // lookup failed: ask again next time
+  free(buf);
+  return name;
+}
 
-    // descend into child directory
-    if (e->d_type == DT_DIR && depth < max_depth) {
-        snprintf(full, sizeof full, "%s/%s", path, e->d_name);
-        if (subtree_has_match(full, pstr, depth + 1, stats, typech)) { found = 1; break; }
+/// @brief fill a cache from /etc/passwd or /etc/group, read at once. Lines are "name:x:id:...";
+/// the first line of an id wins, as with getpwuid/getgrgid on these files.
+/// @param c cache
+/// @param file /etc/passwd or /etc/group
+static void cache_prewarm(struct name_cache *c, const char *file)
+{
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  char *buf;
+
+  if (fd < 0) return;
+  if (fstat(fd, &st) == -1 || (buf = malloc(st.st_size + 1)) == NULL) {
+    close(fd);
+    return;
+  }
+  ssize_t len = read(fd, buf, st.st_size);
+  close(fd);
+  if (len < 0) len = 0;
+  buf[len] = '\0';
+
+  pthread_rwlock_wrlock(&c->lock);
+  for (char *line = buf, *next; *line; line = next) {
+    next = strchr(line, '\n');
+    if (next) *next++ = '\0';
+    else next = line + strlen(line);
+
+    char *field[3] = { line, NULL, NULL };
+    for (int k = 1; k < 3 && field[k - 1]; k++) {
+      field[k] = strchr(field[k - 1], ':');
+      if (field[k]) *field[k]++ = '\0';
     }
+    char *end;
+    if (line[0] == '\0' || line[0] == '#' || line[0] == '+' || line[0] == '-' || field[2] == NULL) continue;
+    unsigned long id = strtoul(field[2], &end, 10);
+    if (end == field[2] || (*end != ':' && *end != '\0')) continue;
+    cache_insert(c, (unsigned int)id, line);
   }
+  pthread_rwlock_unlock(&c->lock);
+  free(buf);
+}
+
+/// @brief look up the names of the owner and the group of an entry ("?" if there is none).
+/// Thread-safe; the names are cached and must not be freed.
+/// @param st status of the entry
+/// @param user output: the user name
+/// @param group output: the group name
+static void owner_names(const struct stat *st, const char **user, const char **group)
+{
+  *user = cache_lookup(&users, st->st_uid, 0);
+  *group = cache_lookup(&groups, st->st_gid, 1);
+}
+
+/// @brief an entry of a directory traversed by a task (-j) whose output is not simply the next
+/// bytes of the task's text: a subdirectory, a line that depends on the subdirectory, or an error
+struct piece {
+  size_t line;                ///< where the line of the entry starts in the task's text
+  size_t at;                  ///< where it ends (the subdirectory's lines go here)
+  struct task *child;         ///< task of the subdirectory, or NULL
+  int cond;                   ///< filter: the line is only printed if something below it matches
+  int err;                    ///< errno of a failed lstat, 0 if there was none
+};
+
+/// @brief a directory traversed by a worker thread (-j). Its lines are formatted into text, and
+/// the tree is stitched together from the tasks once they are all done
+struct task {
+  struct task *parent;        ///< task of the parent directory, NULL for a root
+  char *name;                 ///< name of the directory in the parent directory (path of a root)
+  int fd;                     ///< the open directory, -1 if it cannot be opened
+  int refs;                   ///< the task and its subdirectories' tasks not started yet (fd is
+                              ///< closed when there are none left)
+  int depth;                  ///< depth of its entries
+  int worker;                 ///< worker running the task (it gets the subdirectories)
+  struct text text;           ///< lines of the entries
+  struct piece *pieces;       ///< subdirectories and errors, in the order of the entries
+  int npieces;                ///< number of pieces
+  int cap;                    ///< size of pieces
+  struct summary stats;       ///< counts of the lines that are printed in any case
+  struct arena *arena;        ///< arena of the worker running the task
+  int matched;                ///< filter: the name of an entry matches
+  int has_match;              ///< filter: something below matches (-1 until known)
+};
+
+static void add_child(struct task *task, const char *name, int depth, size_t line, int cond, int err);
+static int process_subdir(int dirfd, const char *name, int depth, const char *pstr, struct summary *stats,
+                          unsigned int flags);
+
+/// @brief open directory @a name in the directory @a dirfd
+/// @param dirfd open directory, or AT_FDCWD
+/// @param name name of the directory in dirfd (or path)
+/// @retval file descriptor on success
+/// @retval -1 on error
+static int open_dir(int dirfd, const char *name)
+{
+  return openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
 
-  closedir(dir);
-  return found;
+/// @brief print a line of a directory's entries: into the task's text if there is a task, straight
+/// to stdout when nothing above it may still be dropped, into fout otherwise
+/// @param task task of the directory or NULL
+/// @param format printf format string
+static void out_printf(struct task *task, const char *format, ...)
+{
+  va_list ap;
+
+  va_start(ap, format);
+  if (task)                  text_vprintf(&task->text, format, ap);
+  else if (fout.pending > 0) text_vprintf(&fout.held, format, ap);
+  else                       vprintf(format, ap);
+  va_end(ap);
 }
 
-/// @brief recursively process directory @a dn and print its tree
+/// @brief report a failed lstat: now, or where the entry is when the task's tree is stitched
+/// @param task task of the directory or NULL
+static void lstat_error(struct task *task)
+{
+  if (task) add_child(task, NULL, 0, task->text.len, 0, errno);
+  else perror("lstat");
+}
+
+/// @brief recursively process the open directory @a fd and print its tree
+///
+/// With a filter, the tree is traversed once, in post-order: a subdirectory is traversed before it
+/// is known whether its line is printed, and the lines are held in fout until it is.
+///
+/// The directory is traversed through its file descriptor: the entries are looked up with fstatat
+/// and the subdirectories opened with openat, relative to it, so no path is built.
 ///
-/// @param dn absolute or relative path string
+/// With a task (-j), the lines go into the task's text and the subdirectories become tasks of their
+/// own instead of being traversed; whether the line of a directory is printed is then only decided
+/// when the tree is stitched.
+///
+/// @param fd open directory
+/// @param depth depth of its entries
 /// @param pstr prefix string printed in front of each entry
 /// @param stats pointer to statistics
 /// @param flags output control flags (F_*)
+/// @param task task of the directory, or NULL to traverse the tree here
+/// @retval 1 if (with a filter) the name of an entry below the directory matches, 0 if none does
+/// (with a task: the name of an entry of the directory)
 
-static int process_dir(const char *path, int depth, const char *pstr, struct summary *stats, unsigned int flags)
+static int process_dir(int fd, int depth, const char *pstr, struct summary *stats, unsigned int flags,
+                       struct task *task)
 {
   // TODO
-  DIR *dir = opendir(path);                  //open directory
-  if(dir == NULL) return -1;                 //return if directory doesn't exist
+  static struct arena serial_arena;
+  struct arena *a = task ? task->arena : &serial_arena;
+  if (a->buf == NULL && (a->buf = malloc(DIRENT_BUF)) == NULL) panic("Out of memory.", NULL);
+
+  struct dir_reader dir = { fd, a->buf, 0, 0 };
 
-  struct dirent *list_directories = NULL;   //list of directories for that depth, for later sorting
-  int cap = 0;                              //cap: count of files in that depth
-  struct dirent *e;
+  size_t first = a->n, first_name = a->len; //the entries of this directory are appended to the arena
+  struct linux_dirent64 *e;
 
-  while((e = get_next(dir)) != NULL){       //for each file in that depth, store file into list_directories then sort
-    cap++;
-    list_directories = realloc(list_directories, cap * sizeof(struct dirent)); //reallocate size of array if another file is found
-    list_directories[cap-1] = *e;
+  while((e = get_next(&dir)) != NULL){       //for each file in that depth, store file into the arena then sort
+    arena_add(a, e);
   }
-  qsort(list_directories, cap, sizeof(struct dirent), dirent_compare); //sort directories in that depth first showing directories then alphabetical
+  int cap = a->n - first;                   //cap: count of files in that depth
+  struct entry *list_directories;
+  qsort_r(a->entries + first, cap, sizeof *a->entries, dirent_compare, a->names); //sort directories in that depth first showing directories then alphabetical
 
   // ------ NO F FILTER ------
   if (pstr == NULL) {
     for (int i = 0; i < cap; i++) {
-      const char *name = list_directories[i].d_name;
-      char full[MAX_PATH_LEN];
-      snprintf(full, sizeof full, "%s/%s", path, name);           //make the full path for later
-
+      list_directories = a->entries + first;                      //(the arena may have moved while traversing the last subdirectory)
+      const char *name = a->names + list_directories[i].name;
       struct stat st;
-      if (lstat(full, &st) == -1) { perror("lstat"); continue; }  //get lstat of path, and increment the directory's stats
+      if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) { lstat_error(task); continue; }  //get lstat of entry, and increment the directory's stats
       stats->size   += st.st_size;
       stats->blocks += st.st_blocks;
       
-      struct passwd *pw = getpwuid(st.st_uid);                    //get necessary info (user, group, type, etc)
-      struct group  *gr = getgrgid(st.st_gid);
-      const char *user  = pw ? pw->pw_name : "?";
-      const char *group = gr ? gr->gr_name : "?";
+      const char *user, *group;                                   //get necessary info (user, group, type, etc)
+      owner_names(&st, &user, &group);
 
       char typech = ' ';
       if (S_ISDIR(st.st_mode))  typech = 'd';
@@ -349,13 +824,7 @@ static int process_dir(const char *path, int depth, const char *pstr, struct sum
       else if (S_ISREG(st.st_mode)) stats->files++;
 
       char namecol[256];                                          //format for the path name column
-      int written = snprintf(namecol, sizeof namecol, "%*s%s", depth * 2, "", name);
-      if(written > 54){                                          //if the path string exceeds max length, truncate it
-        namecol[51] = '.';
-        namecol[52] = '.';
-        namecol[53] = '.';
-        namecol[54] = '\0';
-      }
+      name_column(namecol, depth, name, 55);                      //if the path string exceeds max length, truncate it
       
       switch(typech){                                            //update individual summary stats
         case 'd':
@@ -373,14 +842,15 @@ static int process_dir(const char *path, int depth, const char *pstr, struct sum
           break;
       }
 
-      printf(print_formats[2], namecol, user, group, (unsigned long long)st.st_size, (unsigned long long)st.st_blocks, typech);
+      out_printf(task, print_formats[2], namecol, user, group, (unsigned long long)st.st_size, (unsigned long long)st.st_blocks, typech);
 
-      if (list_directories[i].d_type == DT_DIR && depth < max_depth) {
-        (void)process_dir(full, depth + 1, pstr, stats, flags); // keep printing children
+      if (list_directories[i].type == DT_DIR && depth < max_depth) {
+        if (task) add_child(task, name, depth + 1, task->text.len, 0, 0);
+        else (void)process_subdir(fd, name, depth + 1, pstr, stats, flags); // keep printing children
       }
     }
-    closedir(dir);
-    free(list_directories);
+    a->n = first;
+    a->len = first_name;
     return 1;
   }
 
@@ -388,32 +858,22 @@ static int process_dir(const char *path, int depth, const char *pstr, struct sum
   int any_match_in_this_dir = 0;
 
   for (int i = 0; i < cap; i++) {
-    const char *name = list_directories[i].d_name;
-    char full[MAX_PATH_LEN];
-    snprintf(full, sizeof full, "%s/%s", path, name);
+    list_directories = a->entries + first;
+    const char *name = a->names + list_directories[i].name;
+    if (list_directories[i].type == DT_DIR) {           //check whether current directory or child has match
+      int self_matches = match(name, pattern);
 
-    if (list_directories[i].d_type == DT_DIR) {           //check whether current directory or child has match 
-      int child_has_match = (depth < max_depth) ? subtree_has_match(full, pstr, depth + 1, stats, 'd') : 0;
-      int self_matches    = match(name, pattern);
-
-      if (self_matches || child_has_match) {              //if either both is a match, print current file name
-        // Build the name column (indent + name), with simple truncation into 54 chars
-        char namecol[256];
-        int written = snprintf(namecol, sizeof namecol, "%*s%s", depth * 2, "", name);
-        if (written > 54) {              // if path exceeds max length, keep last 3 as "..."
-          namecol[51] = '.';
-          namecol[52] = '.';
-          namecol[53] = '.';
-          namecol[54] = '\0';
-        }
+      // Build the name column (indent + name), with simple truncation into 54 chars
+      char namecol[256];
+      name_column(namecol, depth, name, 55);
 
-        struct stat st;                                  //get necessary info (user, group, type, etc)
-        if (lstat(full, &st) == -1) { perror("lstat"); continue; }
+      struct stat st;
+      if (self_matches) {                                 //the line is printed whatever is below it
+        any_match_in_this_dir = 1;
+        if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) { lstat_error(task); continue; }   //get necessary info (user, group, type, etc)
 
-        struct passwd *pw = getpwuid(st.st_uid);
-        struct group  *gr = getgrgid(st.st_gid);
-        const char *user  = pw ? pw->pw_name : "?";
-        const char *group = gr ? gr->gr_name : "?";
+        const char *user, *group;
+        owner_names(&st, &user, &group);
 
         char typech = ' ';
         if      (S_ISDIR(st.st_mode))  typech = 'd';
@@ -423,51 +883,56 @@ static int process_dir(const char *path, int depth, const char *pstr, struct sum
         else if (S_ISCHR(st.st_mode))  typech = 'c';
         else if (S_ISBLK(st.st_mode))  typech = 'b';
 
-        if (self_matches) {                               //if the current directory is also a match, increment file, size, and block count
-          printf(print_formats[2], namecol, user, group,
-              (unsigned long long)st.st_size,
-              (unsigned long long)st.st_blocks, typech);
-          stats->size   += st.st_size;
-          stats->blocks += st.st_blocks;
-          if      (typech == 'd') stats->dirs++;
-          else if (typech == 'l') stats->links++;
-          else if (typech == 's') stats->socks++;
-          else if (typech == 'f') stats->fifos++;
-          // (devices ignored; add if you need)
-        } else {
-          printf("%s\n", namecol);
+        out_printf(task, print_formats[2], namecol, user, group,   //increment size and block count of the matching directory
+            (unsigned long long)st.st_size,
+            (unsigned long long)st.st_blocks, typech);
+        stats->size   += st.st_size;
+        stats->blocks += st.st_blocks;
+        if      (typech == 'd') stats->dirs++;
+        else if (typech == 'l') stats->links++;
+        else if (typech == 's') stats->socks++;
+        else if (typech == 'f') stats->fifos++;
+        // (devices ignored; add if you need)
+
+        // print matching descendants (a subtree without any prints nothing)
+        if (depth < max_depth) {
+          if (task) add_child(task, name, depth + 1, task->text.len, 0, 0);
+          else (void)process_subdir(fd, name, depth + 1, pstr, stats, flags);
         }
-
-        // Recurse to print matching descendants (only if some child matched)
-        if (child_has_match && depth < max_depth) {
-          (void)process_dir(full, depth + 1, pstr, stats, flags);
+      } else if (task) {                                  //decided when the tree is stitched
+        if (depth < max_depth) {
+          size_t mark = task->text.len;
+          out_printf(task, "%s\n", namecol);
+          add_child(task, name, depth + 1, mark, 1, fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1 ? errno : 0);
         }
-
-        any_match_in_this_dir = 1;
+      } else {                                            //the name-only line, if a descendant matches
+        size_t mark = fout.held.len;
+        struct summary before = *stats;
+
+        fout.pending++;
+        out_printf(NULL, "%s\n", namecol);
+        int child_has_match = (depth < max_depth) ? process_subdir(fd, name, depth + 1, pstr, stats, flags) > 0 : 0;
+        int keep = child_has_match;
+        name = a->names + a->entries[first + i].name;     //(the arena may have moved)
+        if (child_has_match && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) { perror("lstat"); keep = 0; }
+        if (!keep) *stats = before;                       //nothing below it is printed either
+        filter_release(mark, keep);
+        if (child_has_match) any_match_in_this_dir = 1;
       }
 
-
     } else {  //if it's not a directory:
       // print and count only if its own name matches
       int file_matches = match(name, pattern);
       if (file_matches) {
         char namecol[256];
-        int written = snprintf(namecol, sizeof namecol, "%*s%s", depth * 2, "", name);  //format file name, and truncate if needed
-        if (written >= 54) {
-          namecol[51] = '.';
-          namecol[52] = '.';
-          namecol[53] = '.';
-          namecol[54] = '\0';
-        }
+        name_column(namecol, depth, name, 54);          //format file name, and truncate if needed
 
         struct stat st;
-        if (lstat(full, &st) == -1) { perror("lstat"); continue; }
+        if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) { lstat_error(task); continue; }
 
         //get necessary info (user, group, type, etc)
-        struct passwd *pw = getpwuid(st.st_uid);
-        struct group  *gr = getgrgid(st.st_gid);
-        const char *user  = pw ? pw->pw_name : "?";
-        const char *group = gr ? gr->gr_name : "?";
+        const char *user, *group;
+        owner_names(&st, &user, &group);
 
         char typech = ' ';                // keep regular files as space in the Type column
         if      (S_ISLNK(st.st_mode))  typech = 'l';
@@ -476,7 +941,7 @@ static int process_dir(const char *path, int depth, const char *pstr, struct sum
         else if (S_ISCHR(st.st_mode))  typech = 'c';
         else if (S_ISBLK(st.st_mode))  typech = 'b';
 
-        printf(print_formats[2], namecol, user, group,
+        out_printf(task, print_formats[2], namecol, user, group,
               (unsigned long long)st.st_size,
               (unsigned long long)st.st_blocks, typech);
   
@@ -493,11 +958,269 @@ static int process_dir(const char *path, int depth, const char *pstr, struct sum
     }
   }
 
-  closedir(dir);
-  free(list_directories);
+  a->n = first;
+  a->len = first_name;
   return any_match_in_this_dir;
 }
 
+//--------------------------------------------------------------------------------------------------
+// Parallel traversal (-j)
+//
+// Every directory is a task. A worker formats the lines of the directory's entries into the task's
+// text and makes a new task of every subdirectory, which it pushes onto its own queue. A worker
+// takes the newest task from its own queue; when that is empty it steals the oldest task of
+// another worker, which is the one closest to the root and so most likely the largest subtree.
+// Once all tasks are done, the tree is stitched: each task's text is printed, with the output of
+// the subdirectories' tasks in between, in the same order as the serial traversal prints them.
+
+/// @brief queue of tasks of a worker
+struct deque {
+  pthread_mutex_t lock;
+  struct task **tasks;        ///< the tasks between head and tail
+  int head;                   ///< oldest task (stolen by other workers)
+  int tail;                   ///< one past the newest task (taken by the owner)
+  int cap;                    ///< size of tasks
+};
+
+/// @brief the worker threads
+static struct {
+  struct deque *q;            ///< queue of every worker
+  pthread_mutex_t lock;       ///< protects queued and running
+  pthread_cond_t wake;        ///< signaled when a task is queued or the last one is done
+  int queued;                 ///< tasks on the queues
+  int running;                ///< tasks being run
+  unsigned int flags;         ///< output control flags (F_*)
+} pool = { NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0 };
+
+/// @brief allocate a task
+/// @param parent task of the parent directory, NULL for a root
+/// @param name name of the directory in the parent directory (path of a root)
+/// @param depth depth of its entries
+/// @retval the task
+static struct task *new_task(struct task *parent, const char *name, int depth)
+{
+  struct task *t = calloc(1, sizeof *t);
+  if (t == NULL || (t->name = strdup(name)) == NULL) panic("Out of memory.", NULL);
+  t->parent = parent;
+  t->fd = -1;
+  t->refs = 1;
+  t->depth = depth;
+  t->has_match = -1;
+  return t;
+}
+
+/// @brief drop a reference to the directory of a task, closing it with the last one
+/// @param t task
+static void release_task(struct task *t)
+{
+  if (__atomic_sub_fetch(&t->refs, 1, __ATOMIC_ACQ_REL) == 0 && t->fd >= 0) close(t->fd);
+}
+
+/// @brief push a task onto the queue of worker @a w
+/// @param w worker
+/// @param t task
+static void push_task(int w, struct task *t)
+{
+  struct deque *q = &pool.q[w];
+
+  pthread_mutex_lock(&q->lock);
+  if (q->head > 0 && q->tail == q->cap) {           // move the tasks left to the front
+    memmove(q->tasks, q->tasks + q->head, (q->tail - q->head) * sizeof *q->tasks);
+    q->tail -= q->head;
+    q->head = 0;
+  }
+  if (q->tail == q->cap) {
+    q->cap = q->cap ? q->cap * 2 : 64;
+    q->tasks = realloc(q->tasks, q->cap * sizeof *q->tasks);
+    if (q->tasks == NULL) panic("Out of memory.", NULL);
+  }
+  q->tasks[q->tail++] = t;
+  pthread_mutex_unlock(&q->lock);
+
+  pthread_mutex_lock(&pool.lock);
+  pool.queued++;
+  pthread_cond_signal(&pool.wake);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+/// @brief add an entry to the pieces of a task: a subdirectory (which is pushed as a new task) or
+/// an error
+/// @param task task of the directory
+/// @param name name of the subdirectory, or NULL
+/// @param depth depth of the subdirectory's entries
+/// @param line where the line of the entry starts in the task's text
+/// @param cond the line is only printed if something below it matches
+/// @param err errno of a failed lstat, 0 if there was none
+static void add_child(struct task *task, const char *name, int depth, size_t line, int cond, int err)
+{
+  if (task->npieces == task->cap) {
+    task->cap = task->cap ? task->cap * 2 : 16;
+    task->pieces = realloc(task->pieces, task->cap * sizeof *task->pieces);
+    if (task->pieces == NULL) panic("Out of memory.", NULL);
+  }
+  struct piece *p = &task->pieces[task->npieces++];
+  p->line = line;
+  p->at = task->text.len;
+  p->child = name ? new_task(task, name, depth) : NULL;
+  p->cond = cond;
+  p->err = err;
+  if (p->child) {                                   // the directory stays open until the child opens its own
+    __atomic_add_fetch(&task->refs, 1, __ATOMIC_RELAXED);
+    push_task(task->worker, p->child);
+  }
+}
+
+/// @brief take a task: the newest of worker @a w's own, or else the oldest of another worker's
+/// @param w worker
+/// @param n number of workers
+/// @retval a task, or NULL once all tasks are done
+static struct task *take_task(int w, int n)
+{
+  while (1) {
+    struct task *t = NULL;
+    for (int k = 0; k < n && t == NULL; k++) {
+      struct deque *q = &pool.q[(w + k) % n];
+      pthread_mutex_lock(&q->lock);
+      if (q->head < q->tail) t = (k == 0) ? q->tasks[--q->tail] : q->tasks[q->head++];
+      pthread_mutex_unlock(&q->lock);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    if (t) {
+      pool.queued--;
+      pool.running++;
+    }
+    else if (pool.queued == 0 && pool.running == 0) {
+      pthread_mutex_unlock(&pool.lock);
+      return NULL;
+    }
+    else if (pool.queued == 0) pthread_cond_wait(&pool.wake, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    if (t) return t;
+  }
+}
+
+/// @brief worker thread: runs tasks until all are done
+/// @param arg index of the worker
+static void *worker(void *arg)
+{
+  int w = (int)(intptr_t)arg;
+  struct arena arena = { 0 };
+  struct task *t;
+
+  while ((t = take_task(w, nthreads)) != NULL) {
+    t->worker = w;
+    t->arena = &arena;
+    t->fd = open_dir(t->parent ? t->parent->fd : AT_FDCWD, t->name);
+    if (t->parent) release_task(t->parent);
+    t->matched = t->fd >= 0 && process_dir(t->fd, t->depth, pattern, &t->stats, pool.flags, t) > 0;
+    release_task(t);
+
+    pthread_mutex_lock(&pool.lock);
+    if (--pool.running == 0 && pool.queued == 0) pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+  }
+  arena_free(&arena);
+  return NULL;
+}
+
+/// @brief traverse the trees of all roots with nthreads worker threads
+/// @param roots task of every root
+/// @param nroots number of roots
+/// @param flags output control flags (F_*)
+static void run_tasks(struct task **roots, int nroots, unsigned int flags)
+{
+  pthread_t *threads = malloc(nthreads * sizeof *threads);
+  pool.q = calloc(nthreads, sizeof *pool.q);
+  if (threads == NULL || pool.q == NULL) panic("Out of memory.", NULL);
+  pool.flags = flags;
+  for (int w = 0; w < nthreads; w++) pthread_mutex_init(&pool.q[w].lock, NULL);
+  for (int j = 0; j < nroots; j++) push_task(j % nthreads, roots[j]);
+
+  for (int w = 0; w < nthreads; w++) {
+    if (pthread_create(&threads[w], NULL, worker, (void *)(intptr_t)w) != 0) panic("Cannot create thread.", NULL);
+  }
+  for (int w = 0; w < nthreads; w++) pthread_join(threads[w], NULL);
+
+  for (int w = 0; w < nthreads; w++) {
+    pthread_mutex_destroy(&pool.q[w].lock);
+    free(pool.q[w].tasks);
+  }
+  free(pool.q);
+  free(threads);
+}
+
+/// @brief whether the name of an entry below a task's directory matches (filter)
+/// @param t task
+/// @retval 1 if one does, 0 if none does
+static int has_match(struct task *t)
+{
+  if (t->has_match < 0) {
+    t->has_match = t->matched;
+    for (int i = 0; i < t->npieces && !t->has_match; i++) {
+      if (t->pieces[i].child && has_match(t->pieces[i].child)) t->has_match = 1;
+    }
+  }
+  return t->has_match;
+}
+
+/// @brief free a task and the tasks of its subdirectories
+/// @param t task
+static void free_task(struct task *t)
+{
+  for (int i = 0; i < t->npieces; i++) {
+    if (t->pieces[i].child) free_task(t->pieces[i].child);
+  }
+  free(t->name);
+  free(t->text.buf);
+  free(t->pieces);
+  free(t);
+}
+
+/// @brief print the tree of a task and add up its statistics
+/// @param t task
+/// @param stats pointer to statistics
+static void stitch(struct task *t, struct summary *stats)
+{
+  size_t printed = 0;
+
+  stats->dirs   += t->stats.dirs;
+  stats->files  += t->stats.files;
+  stats->links  += t->stats.links;
+  stats->fifos  += t->stats.fifos;
+  stats->socks  += t->stats.socks;
+  stats->size   += t->stats.size;
+  stats->blocks += t->stats.blocks;
+
+  for (int i = 0; i < t->npieces; i++) {
+    struct piece *p = &t->pieces[i];
+    int print = !p->cond || has_match(p->child);     // same decision as the serial traversal
+
+    text_write(&t->text, printed, p->cond ? p->line : p->at);
+    printed = p->at;
+    if (print && p->err) fprintf(stderr, "lstat: %s\n", strerror(p->err));
+    else if (print && p->cond) text_write(&t->text, p->line, p->at);
+    if (p->child && print && !p->err) stitch(p->child, stats);
+  }
+  text_write(&t->text, printed, t->text.len);
+}
+
+/// @brief open subdirectory @a name of the directory @a dirfd and process it (see process_dir())
+/// @param dirfd open directory, or AT_FDCWD
+/// @param name name of the subdirectory in dirfd (or path)
+/// @retval -1 if the directory cannot be opened
+/// @retval what process_dir() returns otherwise
+static int process_subdir(int dirfd, const char *name, int depth, const char *pstr, struct summary *stats,
+                          unsigned int flags)
+{
+  int fd = open_dir(dirfd, name);
+  if (fd < 0) return -1;
+
+  int r = process_dir(fd, depth, pstr, stats, flags, NULL);
+  close(fd);
+  return r;
+}
+
 /// @brief print program syntax and an optional error message. Aborts the program with EXIT_FAILURE
 /// @param argv0 command line argument 0 (executable)
 /// @param error optional error (format) string (printf format) or NULL
@@ -517,16 +1240,19 @@ void syntax(const char *argv0, const char *error, ...)
 
   assert(argv0 != NULL);
 
-  fprintf(stderr, "Usage %s [-d depth] [-f pattern] [-h] [path...]\n"
+  fprintf(stderr, "Usage %s [-d depth] [-f pattern] [-j threads] [-p] [--stats] [-h] [path...]\n"
                   "Recursively traverse directory tree and list all entries. If no path is given, the current directory\n"
                   "is analyzed.\n"
                   "\n"
                   "Options:\n"
                   " -d depth   | set maximum depth of directory traversal (1-%d)\n"
                   " -f pattern | filter entries using pattern (supports \'?\', \'*\', and \'()\')\n"
+                  " -j threads | traverse the directories with this many threads (1-%d)\n"
+                  " -p         | load all user and group names from /etc/passwd and /etc/group up front\n"
+                  " --stats    | print pattern matching statistics on stderr (with -f)\n"
                   " -h         | print this help\n"
                   " path...    | list of space-separated paths (max %d). Default is the current directory.\n",
-                  basename(argv0), MAX_DEPTH, MAX_DIR);
+                  basename(argv0), MAX_DEPTH, MAX_THREADS, MAX_DIR);
 
   exit(EXIT_FAILURE);
 }
@@ -568,6 +1294,19 @@ int main(int argc, char *argv[]) //argc : argument count, argv: array of strings
           syntax(argv[0], "Missing filtering pattern argument.");
         }
       }
+      else if (!strcmp(argv[i], "-j")) {
+        if (++i < argc && argv[i][0] != '-') {
+          nthreads = atoi(argv[i]);
+          if (nthreads < 1 || nthreads > MAX_THREADS) {
+            syntax(argv[0], "Invalid number of threads '%s'. Must be between 1 and %d.", argv[i], MAX_THREADS);
+          }
+        }
+        else {
+          syntax(argv[0], "Missing number of threads argument.");
+        }
+      }
+      else if (!strcmp(argv[i], "-p")) flags |= F_Prewarm;
+      else if (!strcmp(argv[i], "--stats")) flags |= F_Stats;
       else if (!strcmp(argv[i], "-h")) syntax(argv[0], NULL);
       else syntax(argv[0], "Unrecognized option '%s'.", argv[i]);
     }
@@ -587,7 +1326,19 @@ int main(int argc, char *argv[]) //argc : argument count, argv: array of strings
 
   // after arg parsing, before any printing
   if (pattern) {
-    (void)match("", pattern);   // validate once; on invalid, panic() exits now
+    compile_pattern(pattern);   // validate once; on invalid, panic() exits now
+  }
+
+  if (flags & F_Prewarm) {
+    cache_prewarm(&users, "/etc/passwd");
+    cache_prewarm(&groups, "/etc/group");
+  }
+
+  // with -j, all trees are traversed first and printed afterwards
+  struct task *roots[MAX_DIR] = { NULL };
+  if (nthreads > 1) {
+    for (int j = 0; j < ndir; j++) roots[j] = new_task(NULL, directories[j], 1);
+    run_tasks(roots, ndir, flags);
   }
 
   //TODO
@@ -598,7 +1349,11 @@ int main(int argc, char *argv[]) //argc : argument count, argv: array of strings
       //process each directory
       printf("%s%s", print_formats[0], print_formats[1]);
       printf("%s\n", directories[j]);
-      process_dir(directories[j], 1, pattern, &individual_summary, flags);
+      if (roots[j]) {
+        stitch(roots[j], &individual_summary);
+        free_task(roots[j]);
+      }
+      else process_subdir(AT_FDCWD, directories[j], 1, pattern, &individual_summary, flags);
       printf("%s", print_formats[1]);
 
       //different string formats depending on singular/plural
@@ -654,5 +1409,14 @@ int main(int argc, char *argv[]) //argc : argument count, argv: array of strings
       tstat.files + tstat.dirs + tstat.links + tstat.fifos + tstat.socks, 
       tstat.size, tstat.blocks);
   }
+
+  // print pattern matching statistics
+  if ((flags & F_Stats) && pattern) {
+    fflush(stdout);
+    fprintf(stderr, "Pattern '%s', required literal '%s':\n"
+      "  names tested:            %16llu\n"
+      "  rejected by the literal: %16llu\n",
+      pattern, prog.literal, prog.tested, prog.rejected);
+  }
   return EXIT_SUCCESS;
 }
\ No newline at end of file